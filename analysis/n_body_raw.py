@@ -0,0 +1,72 @@
+'''
+MIT License
+
+Copyright (c) 2021 Olaf Willocx
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+'''
+
+'''
+Reader for the flat binary n-body files of Storage::N_Body_Raw (src/storage/n_body_raw.hh).
+
+The file is mapped into memory, so opening is instant and pos[t] only touches the pages of step t.
+
+    times, pos, vel = n_body_raw.load('king.nbr')
+    pos[t]      # (n, 3) view of step t, no copy
+    vel         # None when the file has no velocities
+'''
+
+import sys
+import numpy as np
+
+header_type = np.dtype([('magic', 'S8'), ('version', '<u8'), ('n', '<u8'), ('velocities', '<u8'),
+                        ('record_bytes', '<u8'), ('capacity', '<u8'), ('count', '<u8'),
+                        ('index_offset', '<u8'), ('data_offset', '<u8')])
+entry_type = np.dtype([('time', '<f8'), ('offset', '<u8')])
+
+
+def load(name):
+    data = np.memmap(name, dtype=np.uint8, mode='r')
+    header = data[:header_type.itemsize].view(header_type)[0]
+    if header['magic'] != b'NBODYRAW':
+        raise ValueError(f'{name} is not a raw n-body file')
+    n = int(header['n'])
+    count = int(header['count'])
+    record_bytes = int(header['record_bytes'])
+    data_offset = int(header['data_offset'])
+    index_offset = int(header['index_offset'])
+
+    index = data[index_offset:index_offset + count * entry_type.itemsize].view(entry_type)
+    times = np.array(index['time'])
+
+    # records are equally spaced, so all steps are one strided view
+    def view(offset):
+        return np.ndarray((count, n, 3), dtype='<f8', buffer=data, offset=data_offset + offset,
+                          strides=(record_bytes, 24, 8))
+
+    pos = view(0)
+    vel = view(24 * n) if header['velocities'] else None
+    return times, pos, vel
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        exit()
+    times, pos, vel = load(sys.argv[1])
+    print(f'{pos.shape[0]} steps of {pos.shape[1]} objects, t = {times[0] if len(times) else 0} .. {times[-1] if len(times) else 0}')
@@ -23,35 +23,141 @@
 */
 
 #pragma once
+#include <cmath>
 #include <cstddef>
 #include <numeric>
+#include <algorithm>
+#include <vector>
+#include <omp.h>
+
+//  sums of many doubles with an error that does not grow with their number
+//  the parallel sums split the data into blocks of a fixed size and combine the block sums in order, so that the
+//  result depends on the data only, not on the number of threads or the schedule
+//  strides select every stride-th element, like one component of interleaved xyz
 
 namespace Accurate_Sum
 {
-    double kahan_babuska(const double *const data, const size_t n)
+    //  running sum of Kahan and Babuska (also Neumaier's), the rounding error of every addition is kept in com,
+    //  also when the term is larger than the sum so far
+    struct Compensated
     {
-        double sum = data[0] + data[1];
-        double com = sum - data[1];
-        for (size_t i = 2; i < n; i++)
-        {   const double a = data[i] - com;
-            const double b = sum + a;
-            com = b - sum - a;
-            sum = b;
-        }
-        return sum;
+        double sum = 0;
+        double com = 0;
+
+        void add(const double a) noexcept
+        {   const double t = sum + a;
+            com += std::abs(sum) >= std::abs(a) ? (sum - t) + a : (a - t) + sum;
+            sum = t;
+        }
+
+        void add(const Compensated &c) noexcept
+        {   add(c.sum);
+            com += c.com;
+        }
+
+        double value() const noexcept
+        {   return sum + com;
+        }
+    };
+
+    double kahan_babuska(const double *const data, const size_t n, const size_t stride = 1)
+    {
+        Compensated c;
+        for (size_t i = 0; i < n; i++)
+            c.add(data[i * stride]);
+        return c.value();
+    }
+
+    //  compensated sum in n_lanes independent accumulators, which the compiler keeps in vector registers,
+    //  combined in a fixed order at the end
+    template <size_t n_lanes = 8>
+    Compensated lanes(const double *const data, const size_t n, const size_t stride = 1)
+    {
+        double sum[n_lanes] {};
+        double com[n_lanes] {};
+        const size_t n_full = n / n_lanes * n_lanes;
+        for (size_t i = 0; i < n_full; i += n_lanes)
+        {
+            #pragma omp simd
+            for (size_t l = 0; l < n_lanes; l++)
+            {   const double a = data[(i + l) * stride];
+                const double t = sum[l] + a;
+                com[l] += std::abs(sum[l]) >= std::abs(a) ? (sum[l] - t) + a : (a - t) + sum[l];
+                sum[l] = t;
+            }
+        }
+        Compensated c;
+        for (size_t l = 0; l < n_lanes; l++)
+        {   c.add(sum[l]);
+            c.com += com[l];
+        }
+        for (size_t i = n_full; i < n; i++)
+            c.add(data[i * stride]);
+        return c;
     }
 
+    //  halves until n_direct elements are left, the first half gets the smaller one for odd n
     template <size_t n_direct = 128>
-    double pairwise(const double *const data, const size_t n)
+    double pairwise(const double *const data, const size_t n, const size_t stride = 1)
     {
         if (n <= n_direct)
         {   double sum = 0;
+            #pragma omp simd reduction(+:sum)
             for (size_t i = 0; i < n; i++)
-                sum += data[i];
+                sum += data[i * stride];
             return sum;
         }
         else
-        {   return pairwise<n_direct>(data, n / 2) + pairwise<n_direct>(data + n / 2, n / 2);
+        {   const size_t half = n / 2;
+            return pairwise<n_direct>(data, half, stride) + pairwise<n_direct>(data + half * stride, n - half, stride);
+        }
+    }
+
+    enum class Method { compensated, pairwise };
+
+    //  block of n_block elements at data, by method
+    template <Method method, size_t n_block>
+    Compensated block(const double *const data, const size_t n, const size_t stride, const size_t b)
+    {
+        const size_t begin = b * n_block;
+        const size_t size = std::min(n_block, n - begin);
+        if constexpr (method == Method::compensated)
+            return lanes(data + begin * stride, size, stride);
+        else
+            return {pairwise(data + begin * stride, size, stride), 0};
+    }
+
+    //  parallel sum, threads share the blocks when called outside a parallel region,
+    //  inside one it runs on the calling thread, with the same result
+    template <Method method = Method::compensated, size_t n_block = 1 << 14>
+    double sum(const double *const data, const size_t n, const size_t stride = 1)
+    {
+        const size_t n_blocks = (n + n_block - 1) / n_block;
+        std::vector<Compensated> partial(n_blocks);
+        #pragma omp parallel for if(n_blocks > 1 && !omp_in_parallel())
+        for (size_t b = 0; b < n_blocks; b++)
+            partial[b] = block<method, n_block>(data, n, stride, b);
+        Compensated total;
+        for (const Compensated &p : partial)
+            total.add(p);
+        return total.value();
+    }
+
+    //  x, y and z sums of n interleaved xyz vectors, the three of a block while it is in cache
+    template <Method method = Method::compensated, size_t n_block = 1 << 12>
+    void sum_xyz(const double *const xyz, const size_t n, double *const result)
+    {
+        const size_t n_blocks = (n + n_block - 1) / n_block;
+        std::vector<Compensated> partial(3 * n_blocks);
+        #pragma omp parallel for if(n_blocks > 1 && !omp_in_parallel())
+        for (size_t b = 0; b < n_blocks; b++)
+            for (size_t d = 0; d < 3; d++)
+                partial[3*b+d] = block<method, n_block>(xyz + d, n, 3, b);
+        for (size_t d = 0; d < 3; d++)
+        {   Compensated total;
+            for (size_t b = 0; b < n_blocks; b++)
+                total.add(partial[3*b+d]);
+            result[d] = total.value();
         }
     }
 }
@@ -0,0 +1,169 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "direct_kernel.hh"
+#include "accurate_sum.hh"
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+//  in-situ diagnostics of an isolated system of equal masses, to follow conservation without storing snapshots
+//  per body terms are summed by Accurate_Sum, the potential energy is the direct O(n^2) sum with the softening
+//  of the force, the angular momentum is about the origin and the Lagrangian radii about the center of mass
+//  the per body potentials can also come from elsewhere, like the ring pass of Direct_Mpi
+//  potentials and measure are made of orphaned worksharing loops like Direct_Kernel, so they are called by
+//  every thread of a parallel region, and run on the calling thread only outside of one
+
+namespace Diagnostics
+{
+
+//  fractions of the total mass within the Lagrangian radii, increasing
+constexpr double fractions[] {.01, .05, .1, .25, .5, .75, .9};
+constexpr size_t n_fractions = sizeof(fractions) / sizeof(fractions[0]);
+
+//  one row of the time series, columns in the order of names
+struct Record
+{
+    double time;
+    double kinetic;
+    double potential;
+    double momentum[3];
+    double angular_momentum[3];
+    double com[3];
+    double lagrangian[n_fractions];
+};
+
+constexpr size_t n_columns = sizeof(Record) / sizeof(double);
+static_assert(std::is_standard_layout_v<Record> && n_columns * sizeof(double) == sizeof(Record));
+
+constexpr const char *names[] {"time", "kinetic", "potential", "px", "py", "pz", "lx", "ly", "lz", "x", "y", "z",
+                               "r_0.01", "r_0.05", "r_0.1", "r_0.25", "r_0.5", "r_0.75", "r_0.9"};
+static_assert(sizeof(names) / sizeof(names[0]) == n_columns);
+
+//  work memory for n bodies
+struct Buffers
+{
+    //  kinetic, potential, momentum, angular momentum and mass moment, xyz each
+    static constexpr size_t n_terms = 11;
+
+    size_t n;
+    Direct_Kernel::Soa pos;
+    std::vector<double> phi;    // per body sums of 1 / r over the other bodies
+    std::vector<double> terms;  // n_terms arrays of n per body terms
+    std::vector<double> r2;     // squared distances to the center of mass
+    double sums[n_terms];
+
+    explicit Buffers(const size_t n)
+        : n {n}, pos {n}, phi(n), terms(n_terms * n), r2(n)
+    {}
+};
+
+//  per body sums of the softened 1 / r over the other bodies at pos (interleaved xyz), into b.phi
+void potentials(const double *const pos, Buffers &b, const double eps2) noexcept
+{
+    const size_t n = b.n;
+    b.pos.gather(pos);
+
+    #pragma omp for schedule(dynamic, 64)
+    for (size_t i = 0; i < n; i++)
+    {   const double x = b.pos.x[i];
+        const double y = b.pos.y[i];
+        const double z = b.pos.z[i];
+        b.phi[i] = Direct_Kernel::potential_point(x, y, z, b.pos, 0, i, eps2)
+                 + Direct_Kernel::potential_point(x, y, z, b.pos, i + 1, n, eps2);
+    }
+}
+
+//  diagnostics of the bodies at pos and vel (interleaved xyz) with their sums of 1 / r phi, into record,
+//  complete for every thread on return
+void measure(const double *const pos, const double *const vel, const double *const phi, Buffers &b,
+             const double mass, const double G, const double time, Record &record) noexcept
+{
+    const size_t n = b.n;
+    double *const t = b.terms.data();
+
+    #pragma omp for
+    for (size_t i = 0; i < n; i++)
+    {   const double x = pos[3*i  ], u = vel[3*i  ];
+        const double y = pos[3*i+1], v = vel[3*i+1];
+        const double z = pos[3*i+2], w = vel[3*i+2];
+        t[     i] = .5 * mass * (u * u + v * v + w * w);
+        t[   n+i] = -.5 * G * mass * mass * phi[i];     // every pair is met twice
+        t[ 2*n+i] = mass * u;
+        t[ 3*n+i] = mass * v;
+        t[ 4*n+i] = mass * w;
+        t[ 5*n+i] = mass * (y * w - z * v);
+        t[ 6*n+i] = mass * (z * u - x * w);
+        t[ 7*n+i] = mass * (x * v - y * u);
+        t[ 8*n+i] = mass * x;
+        t[ 9*n+i] = mass * y;
+        t[10*n+i] = mass * z;
+    }
+
+    #pragma omp for
+    for (size_t k = 0; k < Buffers::n_terms; k++)
+        b.sums[k] = Accurate_Sum::sum(t + k * n, n);
+
+    const double total = mass * n;
+    #pragma omp for
+    for (size_t i = 0; i < n; i++)
+    {   const double d1 = pos[3*i  ] - b.sums[8] / total;
+        const double d2 = pos[3*i+1] - b.sums[9] / total;
+        const double d3 = pos[3*i+2] - b.sums[10] / total;
+        b.r2[i] = d1 * d1 + d2 * d2 + d3 * d3;
+    }
+
+    //  every radius is selected from what is beyond the previous one
+    #pragma omp single
+    {   record.time = time;
+        record.kinetic = b.sums[0];
+        record.potential = b.sums[1];
+        for (size_t d = 0; d < 3; d++)
+        {   record.momentum[d] = b.sums[2+d];
+            record.angular_momentum[d] = b.sums[5+d];
+            record.com[d] = b.sums[8+d] / total;
+        }
+        auto begin = b.r2.begin();
+        for (size_t k = 0; k < n_fractions; k++)
+        {   const size_t inside = static_cast<size_t>(std::ceil(fractions[k] * n));
+            const auto nth = b.r2.begin() + (inside > 0 ? inside - 1 : 0);
+            std::nth_element(begin, nth, b.r2.end());
+            record.lagrangian[k] = std::sqrt(*nth);
+            begin = nth;
+        }
+    }
+}
+
+//  same, with the direct potential
+void measure(const double *const pos, const double *const vel, Buffers &b, const double mass, const double G,
+             const double eps2, const double time, Record &record) noexcept
+{
+    potentials(pos, b, eps2);
+    measure(pos, vel, b.phi.data(), b, mass, G, time, record);
+}
+
+};
@@ -0,0 +1,584 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Direct_Kernel
+{
+
+//  loops over all bodies (gather, scatter, accelerate*) are orphaned worksharing
+//  loops, shared by the thread team of the enclosing parallel region, so that drivers can keep one
+//  team for the whole run, called outside a parallel region they run on the calling thread only
+
+//  3D vectors of n bodies as separate x, y and z arrays, each 64 byte aligned and padded to 64 bytes
+template <typename T>
+struct Basic_Soa
+{
+    size_t n;
+    size_t n_pad;
+    T *x;
+    T *y;
+    T *z;
+
+    explicit Basic_Soa(const size_t n)
+        : n {n}, n_pad {(n * sizeof(T) + 63) / 64 * 64 / sizeof(T)}
+    {   x = static_cast<T *>(std::aligned_alloc(64, 3 * n_pad * sizeof(T)));
+        y = x + n_pad;
+        z = y + n_pad;
+        for (size_t i = 0; i < 3 * n_pad; i++)
+            x[i] = 0;
+    }
+
+    ~Basic_Soa()
+    {   std::free(x);
+    }
+
+    Basic_Soa(const Basic_Soa &) = delete;
+    Basic_Soa &operator=(const Basic_Soa &) = delete;
+
+    //  from interleaved xyz
+    void gather(const double *const aos) noexcept
+    {
+        #pragma omp for
+        for (size_t i = 0; i < n; i++)
+        {   x[i] = static_cast<T>(aos[3*i  ]);
+            y[i] = static_cast<T>(aos[3*i+1]);
+            z[i] = static_cast<T>(aos[3*i+2]);
+        }
+    }
+
+    //  to interleaved xyz
+    void scatter(double *const aos) const noexcept
+    {
+        #pragma omp for
+        for (size_t i = 0; i < n; i++)
+        {   aos[3*i  ] = x[i];
+            aos[3*i+1] = y[i];
+            aos[3*i+2] = z[i];
+        }
+    }
+};
+
+using Soa = Basic_Soa<double>;
+using Soa_f = Basic_Soa<float>;
+
+//  acceleration at point p from bodies [j_begin, j_end) of pos, unit masses
+void accelerate_point(const double p1, const double p2, const double p3, const Soa &pos,
+                      const size_t j_begin, const size_t j_end,
+                      const double eps2, double &a1, double &a2, double &a3) noexcept
+{
+    size_t j = j_begin;
+#if defined(__AVX512F__)
+    {   const __m512d q1 = _mm512_set1_pd(p1);
+        const __m512d q2 = _mm512_set1_pd(p2);
+        const __m512d q3 = _mm512_set1_pd(p3);
+        const __m512d e = _mm512_set1_pd(eps2);
+        const __m512d one = _mm512_set1_pd(1);
+        __m512d s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd();
+        __m512d s3 = _mm512_setzero_pd();
+        for (; j + 8 <= j_end; j += 8)
+        {   const __m512d b1 = _mm512_sub_pd(q1, _mm512_loadu_pd(pos.x + j));
+            const __m512d b2 = _mm512_sub_pd(q2, _mm512_loadu_pd(pos.y + j));
+            const __m512d b3 = _mm512_sub_pd(q3, _mm512_loadu_pd(pos.z + j));
+            const __m512d r2 = _mm512_fmadd_pd(b1, b1, _mm512_fmadd_pd(b2, b2, _mm512_fmadd_pd(b3, b3, e)));
+            __m512d c = _mm512_div_pd(one, _mm512_sqrt_pd(r2));
+            c = _mm512_mul_pd(c, _mm512_mul_pd(c, c));
+            s1 = _mm512_fnmadd_pd(c, b1, s1);
+            s2 = _mm512_fnmadd_pd(c, b2, s2);
+            s3 = _mm512_fnmadd_pd(c, b3, s3);
+        }
+        a1 += _mm512_reduce_add_pd(s1);
+        a2 += _mm512_reduce_add_pd(s2);
+        a3 += _mm512_reduce_add_pd(s3);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    {   const __m256d q1 = _mm256_set1_pd(p1);
+        const __m256d q2 = _mm256_set1_pd(p2);
+        const __m256d q3 = _mm256_set1_pd(p3);
+        const __m256d e = _mm256_set1_pd(eps2);
+        const __m256d one = _mm256_set1_pd(1);
+        __m256d s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd();
+        __m256d s3 = _mm256_setzero_pd();
+        for (; j + 4 <= j_end; j += 4)
+        {   const __m256d b1 = _mm256_sub_pd(q1, _mm256_loadu_pd(pos.x + j));
+            const __m256d b2 = _mm256_sub_pd(q2, _mm256_loadu_pd(pos.y + j));
+            const __m256d b3 = _mm256_sub_pd(q3, _mm256_loadu_pd(pos.z + j));
+            const __m256d r2 = _mm256_fmadd_pd(b1, b1, _mm256_fmadd_pd(b2, b2, _mm256_fmadd_pd(b3, b3, e)));
+            __m256d c = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+            c = _mm256_mul_pd(c, _mm256_mul_pd(c, c));
+            s1 = _mm256_fnmadd_pd(c, b1, s1);
+            s2 = _mm256_fnmadd_pd(c, b2, s2);
+            s3 = _mm256_fnmadd_pd(c, b3, s3);
+        }
+        double t[4];
+        _mm256_storeu_pd(t, s1);
+        a1 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s2);
+        a2 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s3);
+        a3 += (t[0] + t[1]) + (t[2] + t[3]);
+    }
+#endif
+    //  scalar fallback and remainder
+    for (; j < j_end; j++)
+    {   const double b1 = p1 - pos.x[j];
+        const double b2 = p2 - pos.y[j];
+        const double b3 = p3 - pos.z[j];
+        double c = 1 / sqrt(b1 * b1 +
+                            b2 * b2 +
+                            b3 * b3 + eps2);
+        c = c * c * c;
+        a1 -= c * b1;
+        a2 -= c * b2;
+        a3 -= c * b3;
+    }
+}
+
+//  acceleration on body i from bodies [j_begin, j_end), unit masses
+//  there is no i != j branch, the body itself contributes nothing since eps2 > 0
+void accelerate_one(const Soa &pos, const size_t i, const size_t j_begin, const size_t j_end,
+                    const double eps2, double &a1, double &a2, double &a3) noexcept
+{
+    accelerate_point(pos.x[i], pos.y[i], pos.z[i], pos, j_begin, j_end, eps2, a1, a2, a3);
+}
+
+//  sum of the softened 1 / r at point p over bodies [j_begin, j_end) of pos, minus the potential for unit masses
+double potential_point(const double p1, const double p2, const double p3, const Soa &pos,
+                       const size_t j_begin, const size_t j_end, const double eps2) noexcept
+{
+    double phi = 0;
+    #pragma omp simd reduction(+:phi)
+    for (size_t j = j_begin; j < j_end; j++)
+    {   const double b1 = p1 - pos.x[j];
+        const double b2 = p2 - pos.y[j];
+        const double b3 = p3 - pos.z[j];
+        phi += 1 / sqrt(b1 * b1 +
+                        b2 * b2 +
+                        b3 * b3 + eps2);
+    }
+    return phi;
+}
+
+//  acceleration and its time derivative (jerk) on body i from bodies [j_begin, j_end), unit masses
+//  with r = x_i - x_j, v = v_i - v_j and c = 1 / |r|^3: a = -sum c r, j = -sum c (v - 3 (r.v) / |r|^2 r)
+void accelerate_jerk_one(const Soa &pos, const Soa &vel, const size_t i, const size_t j_begin, const size_t j_end,
+                         const double eps2, double *const a, double *const jerk) noexcept
+{
+    const double p1 = pos.x[i];
+    const double p2 = pos.y[i];
+    const double p3 = pos.z[i];
+    const double u1 = vel.x[i];
+    const double u2 = vel.y[i];
+    const double u3 = vel.z[i];
+    double a1 = 0, a2 = 0, a3 = 0;
+    double j1 = 0, j2 = 0, j3 = 0;
+    size_t j = j_begin;
+#if defined(__AVX512F__)
+    {   const __m512d q1 = _mm512_set1_pd(p1);
+        const __m512d q2 = _mm512_set1_pd(p2);
+        const __m512d q3 = _mm512_set1_pd(p3);
+        const __m512d w1 = _mm512_set1_pd(u1);
+        const __m512d w2 = _mm512_set1_pd(u2);
+        const __m512d w3 = _mm512_set1_pd(u3);
+        const __m512d e = _mm512_set1_pd(eps2);
+        const __m512d one = _mm512_set1_pd(1);
+        const __m512d three = _mm512_set1_pd(3);
+        __m512d s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd();
+        __m512d s3 = _mm512_setzero_pd();
+        __m512d t1 = _mm512_setzero_pd();
+        __m512d t2 = _mm512_setzero_pd();
+        __m512d t3 = _mm512_setzero_pd();
+        for (; j + 8 <= j_end; j += 8)
+        {   const __m512d b1 = _mm512_sub_pd(q1, _mm512_loadu_pd(pos.x + j));
+            const __m512d b2 = _mm512_sub_pd(q2, _mm512_loadu_pd(pos.y + j));
+            const __m512d b3 = _mm512_sub_pd(q3, _mm512_loadu_pd(pos.z + j));
+            const __m512d v1 = _mm512_sub_pd(w1, _mm512_loadu_pd(vel.x + j));
+            const __m512d v2 = _mm512_sub_pd(w2, _mm512_loadu_pd(vel.y + j));
+            const __m512d v3 = _mm512_sub_pd(w3, _mm512_loadu_pd(vel.z + j));
+            const __m512d r2 = _mm512_fmadd_pd(b1, b1, _mm512_fmadd_pd(b2, b2, _mm512_fmadd_pd(b3, b3, e)));
+            const __m512d d = _mm512_div_pd(one, r2);
+            const __m512d c = _mm512_mul_pd(d, _mm512_sqrt_pd(d));
+            const __m512d rv = _mm512_fmadd_pd(b1, v1, _mm512_fmadd_pd(b2, v2, _mm512_mul_pd(b3, v3)));
+            const __m512d f = _mm512_mul_pd(three, _mm512_mul_pd(rv, d));
+            s1 = _mm512_fnmadd_pd(c, b1, s1);
+            s2 = _mm512_fnmadd_pd(c, b2, s2);
+            s3 = _mm512_fnmadd_pd(c, b3, s3);
+            t1 = _mm512_fnmadd_pd(c, _mm512_fnmadd_pd(f, b1, v1), t1);
+            t2 = _mm512_fnmadd_pd(c, _mm512_fnmadd_pd(f, b2, v2), t2);
+            t3 = _mm512_fnmadd_pd(c, _mm512_fnmadd_pd(f, b3, v3), t3);
+        }
+        a1 += _mm512_reduce_add_pd(s1);
+        a2 += _mm512_reduce_add_pd(s2);
+        a3 += _mm512_reduce_add_pd(s3);
+        j1 += _mm512_reduce_add_pd(t1);
+        j2 += _mm512_reduce_add_pd(t2);
+        j3 += _mm512_reduce_add_pd(t3);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    {   const __m256d q1 = _mm256_set1_pd(p1);
+        const __m256d q2 = _mm256_set1_pd(p2);
+        const __m256d q3 = _mm256_set1_pd(p3);
+        const __m256d w1 = _mm256_set1_pd(u1);
+        const __m256d w2 = _mm256_set1_pd(u2);
+        const __m256d w3 = _mm256_set1_pd(u3);
+        const __m256d e = _mm256_set1_pd(eps2);
+        const __m256d one = _mm256_set1_pd(1);
+        const __m256d three = _mm256_set1_pd(3);
+        __m256d s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd();
+        __m256d s3 = _mm256_setzero_pd();
+        __m256d t1 = _mm256_setzero_pd();
+        __m256d t2 = _mm256_setzero_pd();
+        __m256d t3 = _mm256_setzero_pd();
+        for (; j + 4 <= j_end; j += 4)
+        {   const __m256d b1 = _mm256_sub_pd(q1, _mm256_loadu_pd(pos.x + j));
+            const __m256d b2 = _mm256_sub_pd(q2, _mm256_loadu_pd(pos.y + j));
+            const __m256d b3 = _mm256_sub_pd(q3, _mm256_loadu_pd(pos.z + j));
+            const __m256d v1 = _mm256_sub_pd(w1, _mm256_loadu_pd(vel.x + j));
+            const __m256d v2 = _mm256_sub_pd(w2, _mm256_loadu_pd(vel.y + j));
+            const __m256d v3 = _mm256_sub_pd(w3, _mm256_loadu_pd(vel.z + j));
+            const __m256d r2 = _mm256_fmadd_pd(b1, b1, _mm256_fmadd_pd(b2, b2, _mm256_fmadd_pd(b3, b3, e)));
+            const __m256d d = _mm256_div_pd(one, r2);
+            const __m256d c = _mm256_mul_pd(d, _mm256_sqrt_pd(d));
+            const __m256d rv = _mm256_fmadd_pd(b1, v1, _mm256_fmadd_pd(b2, v2, _mm256_mul_pd(b3, v3)));
+            const __m256d f = _mm256_mul_pd(three, _mm256_mul_pd(rv, d));
+            s1 = _mm256_fnmadd_pd(c, b1, s1);
+            s2 = _mm256_fnmadd_pd(c, b2, s2);
+            s3 = _mm256_fnmadd_pd(c, b3, s3);
+            t1 = _mm256_fnmadd_pd(c, _mm256_fnmadd_pd(f, b1, v1), t1);
+            t2 = _mm256_fnmadd_pd(c, _mm256_fnmadd_pd(f, b2, v2), t2);
+            t3 = _mm256_fnmadd_pd(c, _mm256_fnmadd_pd(f, b3, v3), t3);
+        }
+        double t[4];
+        _mm256_storeu_pd(t, s1);
+        a1 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s2);
+        a2 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s3);
+        a3 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, t1);
+        j1 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, t2);
+        j2 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, t3);
+        j3 += (t[0] + t[1]) + (t[2] + t[3]);
+    }
+#endif
+    //  scalar fallback and remainder
+    for (; j < j_end; j++)
+    {   const double b1 = p1 - pos.x[j];
+        const double b2 = p2 - pos.y[j];
+        const double b3 = p3 - pos.z[j];
+        const double v1 = u1 - vel.x[j];
+        const double v2 = u2 - vel.y[j];
+        const double v3 = u3 - vel.z[j];
+        const double d = 1 / (b1 * b1 + b2 * b2 + b3 * b3 + eps2);
+        const double c = d * sqrt(d);
+        const double f = 3 * (b1 * v1 + b2 * v2 + b3 * v3) * d;
+        a1 -= c * b1;
+        a2 -= c * b2;
+        a3 -= c * b3;
+        j1 -= c * (v1 - f * b1);
+        j2 -= c * (v2 - f * b2);
+        j3 -= c * (v3 - f * b3);
+    }
+    a[0] = a1;
+    a[1] = a2;
+    a[2] = a3;
+    jerk[0] = j1;
+    jerk[1] = j2;
+    jerk[2] = j3;
+}
+
+//  mixed precision acceleration on body i from bodies [j_begin, j_end), unit masses
+//  separations and inverse distances are single precision, with a hardware reciprocal square root
+//  refined by one Newton-Raphson step to about full float precision, the sum is double precision
+void accelerate_one(const Soa_f &pos, const size_t i, const size_t j_begin, const size_t j_end,
+                    const double eps2, double &a1, double &a2, double &a3) noexcept
+{
+    const float p1 = pos.x[i];
+    const float p2 = pos.y[i];
+    const float p3 = pos.z[i];
+    size_t j = j_begin;
+#if defined(__AVX512F__)
+    {   const __m512 q1 = _mm512_set1_ps(p1);
+        const __m512 q2 = _mm512_set1_ps(p2);
+        const __m512 q3 = _mm512_set1_ps(p3);
+        const __m512 e = _mm512_set1_ps(static_cast<float>(eps2));
+        const __m512 half = _mm512_set1_ps(.5f);
+        const __m512 three_halves = _mm512_set1_ps(1.5f);
+        __m512d s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd();
+        __m512d s3 = _mm512_setzero_pd();
+        for (; j + 16 <= j_end; j += 16)
+        {   const __m512 b1 = _mm512_sub_ps(q1, _mm512_loadu_ps(pos.x + j));
+            const __m512 b2 = _mm512_sub_ps(q2, _mm512_loadu_ps(pos.y + j));
+            const __m512 b3 = _mm512_sub_ps(q3, _mm512_loadu_ps(pos.z + j));
+            const __m512 r2 = _mm512_fmadd_ps(b1, b1, _mm512_fmadd_ps(b2, b2, _mm512_fmadd_ps(b3, b3, e)));
+            __m512 c = _mm512_rsqrt14_ps(r2);
+            c = _mm512_mul_ps(c, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(c, c), three_halves));
+            c = _mm512_mul_ps(c, _mm512_mul_ps(c, c));
+            const __m512 f1 = _mm512_mul_ps(c, b1);
+            const __m512 f2 = _mm512_mul_ps(c, b2);
+            const __m512 f3 = _mm512_mul_ps(c, b3);
+            s1 = _mm512_sub_pd(s1, _mm512_cvtps_pd(_mm512_castps512_ps256(f1)));
+            s2 = _mm512_sub_pd(s2, _mm512_cvtps_pd(_mm512_castps512_ps256(f2)));
+            s3 = _mm512_sub_pd(s3, _mm512_cvtps_pd(_mm512_castps512_ps256(f3)));
+            s1 = _mm512_sub_pd(s1, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(f1), 1))));
+            s2 = _mm512_sub_pd(s2, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(f2), 1))));
+            s3 = _mm512_sub_pd(s3, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(f3), 1))));
+        }
+        a1 += _mm512_reduce_add_pd(s1);
+        a2 += _mm512_reduce_add_pd(s2);
+        a3 += _mm512_reduce_add_pd(s3);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    {   const __m256 q1 = _mm256_set1_ps(p1);
+        const __m256 q2 = _mm256_set1_ps(p2);
+        const __m256 q3 = _mm256_set1_ps(p3);
+        const __m256 e = _mm256_set1_ps(static_cast<float>(eps2));
+        const __m256 half = _mm256_set1_ps(.5f);
+        const __m256 three_halves = _mm256_set1_ps(1.5f);
+        __m256d s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd();
+        __m256d s3 = _mm256_setzero_pd();
+        for (; j + 8 <= j_end; j += 8)
+        {   const __m256 b1 = _mm256_sub_ps(q1, _mm256_loadu_ps(pos.x + j));
+            const __m256 b2 = _mm256_sub_ps(q2, _mm256_loadu_ps(pos.y + j));
+            const __m256 b3 = _mm256_sub_ps(q3, _mm256_loadu_ps(pos.z + j));
+            const __m256 r2 = _mm256_fmadd_ps(b1, b1, _mm256_fmadd_ps(b2, b2, _mm256_fmadd_ps(b3, b3, e)));
+            __m256 c = _mm256_rsqrt_ps(r2);
+            c = _mm256_mul_ps(c, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(c, c), three_halves));
+            c = _mm256_mul_ps(c, _mm256_mul_ps(c, c));
+            const __m256 f1 = _mm256_mul_ps(c, b1);
+            const __m256 f2 = _mm256_mul_ps(c, b2);
+            const __m256 f3 = _mm256_mul_ps(c, b3);
+            s1 = _mm256_sub_pd(s1, _mm256_cvtps_pd(_mm256_castps256_ps128(f1)));
+            s2 = _mm256_sub_pd(s2, _mm256_cvtps_pd(_mm256_castps256_ps128(f2)));
+            s3 = _mm256_sub_pd(s3, _mm256_cvtps_pd(_mm256_castps256_ps128(f3)));
+            s1 = _mm256_sub_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(f1, 1)));
+            s2 = _mm256_sub_pd(s2, _mm256_cvtps_pd(_mm256_extractf128_ps(f2, 1)));
+            s3 = _mm256_sub_pd(s3, _mm256_cvtps_pd(_mm256_extractf128_ps(f3, 1)));
+        }
+        double t[4];
+        _mm256_storeu_pd(t, s1);
+        a1 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s2);
+        a2 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s3);
+        a3 += (t[0] + t[1]) + (t[2] + t[3]);
+    }
+#endif
+    //  scalar fallback and remainder
+    for (; j < j_end; j++)
+    {   const float b1 = p1 - pos.x[j];
+        const float b2 = p2 - pos.y[j];
+        const float b3 = p3 - pos.z[j];
+        float c = 1 / sqrtf(b1 * b1 +
+                            b2 * b2 +
+                            b3 * b3 + static_cast<float>(eps2));
+        c = c * c * c;
+        a1 -= c * b1;
+        a2 -= c * b2;
+        a3 -= c * b3;
+    }
+}
+
+//  acceleration on every body from every body, mixed precision if pos is Soa_f
+//  in tiles of n_i bodies by n_j sources, so the sources of a tile stay in cache while the n_i bodies sweep them
+//  then(i_begin, i_end) is called by the same thread as soon as the accelerations of a tile are final
+template <size_t n_i = 256, size_t n_j = 2048, typename T, typename Then>
+void accelerate_then(const Basic_Soa<T> &pos, Soa &acc, const double eps2, Then &&then) noexcept
+{
+    const size_t n = pos.n;
+    const size_t n_tiles = (n + n_i - 1) / n_i;
+    #pragma omp for
+    for (size_t t = 0; t < n_tiles; t++)
+    {   const size_t i_begin = t * n_i;
+        const size_t i_end = std::min(n, i_begin + n_i);
+        for (size_t i = i_begin; i < i_end; i++)
+            acc.x[i] = acc.y[i] = acc.z[i] = 0;
+        for (size_t j_begin = 0; j_begin < n; j_begin += n_j)
+        {   const size_t j_end = std::min(n, j_begin + n_j);
+            for (size_t i = i_begin; i < i_end; i++)
+                accelerate_one(pos, i, j_begin, j_end, eps2, acc.x[i], acc.y[i], acc.z[i]);
+        }
+        then(i_begin, i_end);
+    }
+}
+
+template <size_t n_i = 256, size_t n_j = 2048, typename T>
+void accelerate(const Basic_Soa<T> &pos, Soa &acc, const double eps2) noexcept
+{
+    accelerate_then<n_i, n_j>(pos, acc, eps2, [](size_t, size_t) {});
+}
+
+//  acceleration on body i from bodies [j_begin, j_end), and the opposite on those bodies
+void accelerate_one_symmetric(const Soa &pos, Soa &acc, const size_t i, const size_t j_begin, const size_t j_end,
+                              const double eps2, double &a1, double &a2, double &a3) noexcept
+{
+    const double p1 = pos.x[i];
+    const double p2 = pos.y[i];
+    const double p3 = pos.z[i];
+    size_t j = j_begin;
+#if defined(__AVX512F__)
+    {   const __m512d q1 = _mm512_set1_pd(p1);
+        const __m512d q2 = _mm512_set1_pd(p2);
+        const __m512d q3 = _mm512_set1_pd(p3);
+        const __m512d e = _mm512_set1_pd(eps2);
+        const __m512d one = _mm512_set1_pd(1);
+        __m512d s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd();
+        __m512d s3 = _mm512_setzero_pd();
+        for (; j + 8 <= j_end; j += 8)
+        {   const __m512d b1 = _mm512_sub_pd(q1, _mm512_loadu_pd(pos.x + j));
+            const __m512d b2 = _mm512_sub_pd(q2, _mm512_loadu_pd(pos.y + j));
+            const __m512d b3 = _mm512_sub_pd(q3, _mm512_loadu_pd(pos.z + j));
+            const __m512d r2 = _mm512_fmadd_pd(b1, b1, _mm512_fmadd_pd(b2, b2, _mm512_fmadd_pd(b3, b3, e)));
+            __m512d c = _mm512_div_pd(one, _mm512_sqrt_pd(r2));
+            c = _mm512_mul_pd(c, _mm512_mul_pd(c, c));
+            s1 = _mm512_fnmadd_pd(c, b1, s1);
+            s2 = _mm512_fnmadd_pd(c, b2, s2);
+            s3 = _mm512_fnmadd_pd(c, b3, s3);
+            _mm512_storeu_pd(acc.x + j, _mm512_fmadd_pd(c, b1, _mm512_loadu_pd(acc.x + j)));
+            _mm512_storeu_pd(acc.y + j, _mm512_fmadd_pd(c, b2, _mm512_loadu_pd(acc.y + j)));
+            _mm512_storeu_pd(acc.z + j, _mm512_fmadd_pd(c, b3, _mm512_loadu_pd(acc.z + j)));
+        }
+        a1 += _mm512_reduce_add_pd(s1);
+        a2 += _mm512_reduce_add_pd(s2);
+        a3 += _mm512_reduce_add_pd(s3);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    {   const __m256d q1 = _mm256_set1_pd(p1);
+        const __m256d q2 = _mm256_set1_pd(p2);
+        const __m256d q3 = _mm256_set1_pd(p3);
+        const __m256d e = _mm256_set1_pd(eps2);
+        const __m256d one = _mm256_set1_pd(1);
+        __m256d s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd();
+        __m256d s3 = _mm256_setzero_pd();
+        for (; j + 4 <= j_end; j += 4)
+        {   const __m256d b1 = _mm256_sub_pd(q1, _mm256_loadu_pd(pos.x + j));
+            const __m256d b2 = _mm256_sub_pd(q2, _mm256_loadu_pd(pos.y + j));
+            const __m256d b3 = _mm256_sub_pd(q3, _mm256_loadu_pd(pos.z + j));
+            const __m256d r2 = _mm256_fmadd_pd(b1, b1, _mm256_fmadd_pd(b2, b2, _mm256_fmadd_pd(b3, b3, e)));
+            __m256d c = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+            c = _mm256_mul_pd(c, _mm256_mul_pd(c, c));
+            s1 = _mm256_fnmadd_pd(c, b1, s1);
+            s2 = _mm256_fnmadd_pd(c, b2, s2);
+            s3 = _mm256_fnmadd_pd(c, b3, s3);
+            _mm256_storeu_pd(acc.x + j, _mm256_fmadd_pd(c, b1, _mm256_loadu_pd(acc.x + j)));
+            _mm256_storeu_pd(acc.y + j, _mm256_fmadd_pd(c, b2, _mm256_loadu_pd(acc.y + j)));
+            _mm256_storeu_pd(acc.z + j, _mm256_fmadd_pd(c, b3, _mm256_loadu_pd(acc.z + j)));
+        }
+        double t[4];
+        _mm256_storeu_pd(t, s1);
+        a1 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s2);
+        a2 += (t[0] + t[1]) + (t[2] + t[3]);
+        _mm256_storeu_pd(t, s3);
+        a3 += (t[0] + t[1]) + (t[2] + t[3]);
+    }
+#endif
+    //  scalar fallback and remainder
+    for (; j < j_end; j++)
+    {   const double b1 = p1 - pos.x[j];
+        const double b2 = p2 - pos.y[j];
+        const double b3 = p3 - pos.z[j];
+        double c = 1 / sqrt(b1 * b1 +
+                            b2 * b2 +
+                            b3 * b3 + eps2);
+        c = c * c * c;
+        a1 -= c * b1;
+        a2 -= c * b2;
+        a3 -= c * b3;
+        acc.x[j] += c * b1;
+        acc.y[j] += c * b2;
+        acc.z[j] += c * b3;
+    }
+}
+
+//  pair interactions of bodies [i_begin, i_end) with [j_begin, j_end), both sides updated
+//  when the ranges are the same block only pairs j > i are taken
+void tile_symmetric(const Soa &pos, Soa &acc, const size_t i_begin, const size_t i_end,
+                    const size_t j_begin, const size_t j_end, const double eps2) noexcept
+{
+    for (size_t i = i_begin; i < i_end; i++)
+    {   double a1 = 0;
+        double a2 = 0;
+        double a3 = 0;
+        accelerate_one_symmetric(pos, acc, i, i_begin == j_begin ? i + 1 : j_begin, j_end, eps2, a1, a2, a3);
+        acc.x[i] += a1;
+        acc.y[i] += a2;
+        acc.z[i] += a3;
+    }
+}
+
+//  acceleration on every body from every body, every pair evaluated once (Newton's third law)
+//  bodies are split in blocks of n_block, and block pairs are scheduled as a round robin tournament
+//  (circle method), so in every round each block is in one tile only and tiles run in parallel
+//  without conflicts, and every block sums its tiles in the same order whatever the thread count
+template <size_t n_block = 256>
+void accelerate_symmetric(const Soa &pos, Soa &acc, const double eps2) noexcept
+{
+    const size_t n = pos.n;
+    const size_t n_blocks = (n + n_block - 1) / n_block;
+    //  with an odd number of blocks, one extra empty block sits out every round
+    const size_t m = n_blocks + n_blocks % 2;
+
+    #pragma omp for
+    for (size_t i = 0; i < n; i++)
+        acc.x[i] = acc.y[i] = acc.z[i] = 0;
+
+    //  diagonal tiles
+    #pragma omp for
+    for (size_t b = 0; b < n_blocks; b++)
+        tile_symmetric(pos, acc, b * n_block, std::min(n, (b + 1) * n_block),
+                                 b * n_block, std::min(n, (b + 1) * n_block), eps2);
+
+    for (size_t r = 0; r + 1 < m; r++)
+    {
+        #pragma omp for
+        for (size_t k = 0; k < m / 2; k++)
+        {   const size_t b1 = k == 0 ? m - 1 : (r + k) % (m - 1);
+            const size_t b2 = (r + m - 1 - k) % (m - 1);
+            if (b1 >= n_blocks || b2 >= n_blocks)
+                continue;
+            tile_symmetric(pos, acc, b1 * n_block, std::min(n, (b1 + 1) * n_block),
+                                     b2 * n_block, std::min(n, (b2 + 1) * n_block), eps2);
+        }
+    }
+}
+
+};
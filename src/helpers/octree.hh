@@ -0,0 +1,241 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+//  octree over n unit mass bodies, rebuilt from scratch every step
+//  bodies are sorted along a Morton curve so that every node owns a contiguous range of them,
+//  and the monopole and traceless quadrupole of every node are computed bottom-up during the build
+
+template <size_t n_leaf = 16, size_t n_task = 4096>
+struct Octree
+{
+    //  bits per dimension in a Morton key, so also the maximum depth
+    static constexpr size_t n_bits = 21;
+
+    struct Node
+    {   double center[3];   // geometric center
+        double half;        // half of the side length
+        double com[3];      // center of mass
+        double quad[6];     // traceless quadrupole about com, xx xy xz yy yz zz
+        double mass;
+        double delta;       // distance between com and geometric center
+        size_t begin;       // range of bodies in Morton order
+        size_t end;
+        size_t child;       // first of 8 consecutive children, 0 for a leaf
+    };
+
+    std::vector<Node> nodes;
+    std::vector<std::pair<uint64_t, size_t>> keys; // Morton key and original index
+    std::vector<double> pos;                        // positions in Morton order
+    size_t n_nodes = 0;
+    bool overflow = false;
+
+    static uint64_t spread(uint64_t a) noexcept
+    {   a &= 0x1fffff;
+        a = (a | a << 32) & 0x1f00000000ffff;
+        a = (a | a << 16) & 0x1f0000ff0000ff;
+        a = (a | a <<  8) & 0x100f00f00f00f00f;
+        a = (a | a <<  4) & 0x10c30c30c30c30c3;
+        a = (a | a <<  2) & 0x1249249249249249;
+        return a;
+    }
+
+    //  mass, com and quadrupole of a leaf, directly from its bodies
+    void leaf_moments(Node &node) const noexcept
+    {   node.mass = static_cast<double>(node.end - node.begin);
+        double c[3] {};
+        for (size_t k = node.begin; k < node.end; k++)
+            for (size_t d = 0; d < 3; d++)
+                c[d] += pos[3*k+d];
+        for (size_t d = 0; d < 3; d++)
+            node.com[d] = node.mass > 0 ? c[d] / node.mass : node.center[d];
+        for (size_t d = 0; d < 6; d++)
+            node.quad[d] = 0;
+        for (size_t k = node.begin; k < node.end; k++)
+        {   const double b1 = pos[3*k  ] - node.com[0];
+            const double b2 = pos[3*k+1] - node.com[1];
+            const double b3 = pos[3*k+2] - node.com[2];
+            const double b = b1 * b1 + b2 * b2 + b3 * b3;
+            node.quad[0] += 3 * b1 * b1 - b;
+            node.quad[1] += 3 * b1 * b2;
+            node.quad[2] += 3 * b1 * b3;
+            node.quad[3] += 3 * b2 * b2 - b;
+            node.quad[4] += 3 * b2 * b3;
+            node.quad[5] += 3 * b3 * b3 - b;
+        }
+    }
+
+    //  mass, com and quadrupole of an internal node from its children (parallel axis theorem)
+    void internal_moments(Node &node) const noexcept
+    {   node.mass = 0;
+        double c[3] {};
+        for (size_t i = 0; i < 8; i++)
+        {   const Node &child = nodes[node.child+i];
+            node.mass += child.mass;
+            for (size_t d = 0; d < 3; d++)
+                c[d] += child.mass * child.com[d];
+        }
+        for (size_t d = 0; d < 3; d++)
+            node.com[d] = c[d] / node.mass;
+        for (size_t d = 0; d < 6; d++)
+            node.quad[d] = 0;
+        for (size_t i = 0; i < 8; i++)
+        {   const Node &child = nodes[node.child+i];
+            if (child.mass == 0)
+                continue;
+            const double b1 = child.com[0] - node.com[0];
+            const double b2 = child.com[1] - node.com[1];
+            const double b3 = child.com[2] - node.com[2];
+            const double b = b1 * b1 + b2 * b2 + b3 * b3;
+            node.quad[0] += child.quad[0] + child.mass * (3 * b1 * b1 - b);
+            node.quad[1] += child.quad[1] + child.mass * (3 * b1 * b2);
+            node.quad[2] += child.quad[2] + child.mass * (3 * b1 * b3);
+            node.quad[3] += child.quad[3] + child.mass * (3 * b2 * b2 - b);
+            node.quad[4] += child.quad[4] + child.mass * (3 * b2 * b3);
+            node.quad[5] += child.quad[5] + child.mass * (3 * b3 * b3 - b);
+        }
+    }
+
+    void build_node(const size_t index, const size_t level) noexcept
+    {   Node &node = nodes[index];
+        node.child = 0;
+        if (node.end - node.begin <= n_leaf || level == n_bits)
+        {   leaf_moments(node);
+            node.delta = sqrt((node.com[0] - node.center[0]) * (node.com[0] - node.center[0]) +
+                              (node.com[1] - node.center[1]) * (node.com[1] - node.center[1]) +
+                              (node.com[2] - node.center[2]) * (node.com[2] - node.center[2]));
+            return;
+        }
+
+        //  claim 8 consecutive nodes, if there is no room left the build is redone with more
+        size_t first;
+        #pragma omp atomic capture
+        {   first = n_nodes; n_nodes += 8;
+        }
+        if (first + 8 > nodes.size())
+        {
+            #pragma omp atomic write
+            overflow = true;
+            leaf_moments(node);
+            return;
+        }
+        node.child = first;
+
+        //  octant of a body at this level is the 3 bit digit of its key, x y z from high to low
+        const size_t shift = 3 * (n_bits - 1 - level);
+        size_t begin = node.begin;
+        for (size_t i = 0; i < 8; i++)
+        {   const size_t end = std::partition_point(keys.begin() + begin, keys.begin() + node.end,
+                [=](const std::pair<uint64_t, size_t> &key) { return (key.first >> shift & 7) <= i; })
+                - keys.begin();
+            Node &child = nodes[first+i];
+            child.half = .5 * node.half;
+            child.center[0] = node.center[0] + (i & 4 ? child.half : -child.half);
+            child.center[1] = node.center[1] + (i & 2 ? child.half : -child.half);
+            child.center[2] = node.center[2] + (i & 1 ? child.half : -child.half);
+            child.begin = begin;
+            child.end = end;
+            if (end - begin > n_task)
+            {
+                #pragma omp task default(shared) firstprivate(first, i, level)
+                build_node(first + i, level + 1);
+            }
+            else
+                build_node(first + i, level + 1);
+            begin = end;
+        }
+        #pragma omp taskwait
+
+        internal_moments(node);
+        node.delta = sqrt((node.com[0] - node.center[0]) * (node.com[0] - node.center[0]) +
+                          (node.com[1] - node.center[1]) * (node.com[1] - node.center[1]) +
+                          (node.com[2] - node.center[2]) * (node.com[2] - node.center[2]));
+    }
+
+    void build(const double *const state, const size_t n)
+    {
+        //  bounding cube
+        double lo1 = INFINITY, lo2 = INFINITY, lo3 = INFINITY;
+        double hi1 = -INFINITY, hi2 = -INFINITY, hi3 = -INFINITY;
+        #pragma omp parallel for default(none) shared(n, state) reduction(min: lo1, lo2, lo3) reduction(max: hi1, hi2, hi3)
+        for (size_t i = 0; i < n; i++)
+        {   lo1 = std::min(lo1, state[3*i  ]); hi1 = std::max(hi1, state[3*i  ]);
+            lo2 = std::min(lo2, state[3*i+1]); hi2 = std::max(hi2, state[3*i+1]);
+            lo3 = std::min(lo3, state[3*i+2]); hi3 = std::max(hi3, state[3*i+2]);
+        }
+        const double half = .5 * std::max({hi1 - lo1, hi2 - lo2, hi3 - lo3, 1e-300}) * (1 + 1e-12);
+        const double c1 = .5 * (lo1 + hi1);
+        const double c2 = .5 * (lo2 + hi2);
+        const double c3 = .5 * (lo3 + hi3);
+
+        //  sort bodies along the Morton curve
+        keys.resize(n);
+        pos.resize(3 * n);
+        const double scale = (1 << n_bits) / (2 * half);
+        constexpr uint64_t q_max = (1 << n_bits) - 1;
+        #pragma omp parallel for default(none) shared(n, state, c1, c2, c3, half, scale, q_max)
+        for (size_t i = 0; i < n; i++)
+        {   const uint64_t q1 = std::min(static_cast<uint64_t>((state[3*i  ] - c1 + half) * scale), q_max);
+            const uint64_t q2 = std::min(static_cast<uint64_t>((state[3*i+1] - c2 + half) * scale), q_max);
+            const uint64_t q3 = std::min(static_cast<uint64_t>((state[3*i+2] - c3 + half) * scale), q_max);
+            keys[i] = {spread(q1) << 2 | spread(q2) << 1 | spread(q3), i};
+        }
+        std::sort(keys.begin(), keys.end());
+        #pragma omp parallel for default(none) shared(n, state)
+        for (size_t k = 0; k < n; k++)
+        {   const size_t i = keys[k].second;
+            pos[3*k  ] = state[3*i  ];
+            pos[3*k+1] = state[3*i+1];
+            pos[3*k+2] = state[3*i+2];
+        }
+
+        //  build, growing the node storage until it fits
+        if (nodes.size() < 1 + 8 * (n / n_leaf + 1))
+            nodes.resize(1 + 8 * (n / n_leaf + 1));
+        while (true)
+        {   n_nodes = 1;
+            overflow = false;
+            Node &root = nodes[0];
+            root.center[0] = c1;
+            root.center[1] = c2;
+            root.center[2] = c3;
+            root.half = half;
+            root.begin = 0;
+            root.end = n;
+            #pragma omp parallel
+            #pragma omp single
+            build_node(0, 0);
+            if (!overflow)
+                break;
+            nodes.resize(2 * nodes.size());
+        }
+    }
+};
@@ -0,0 +1,98 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <array>
+#include <cstddef>
+
+namespace Splitting
+{
+
+//  symmetric drift-kick compositions of one step dt
+//      drift(c[0] dt) kick(d[0] dt) drift(c[1] dt) ... kick(d[m-1] dt) drift(c[m] dt)
+//  with drift x += h v and kick v += h a(x), so m force evaluations per step
+//  consistency requires sum c = sum d = 1
+
+template <size_t m>
+struct Scheme
+{
+    static constexpr size_t n_kicks = m;
+    std::array<double, m + 1> c;
+    std::array<double, m> d;
+};
+
+template <size_t m>
+constexpr bool consistent(const Scheme<m> &s) noexcept
+{
+    double c = 0;
+    double d = 0;
+    for (size_t i = 0; i <= m; i++)
+        c += s.c[i];
+    for (size_t i = 0; i < m; i++)
+        d += s.d[i];
+    return c - 1 < 1e-14 && 1 - c < 1e-14 && d - 1 < 1e-14 && 1 - d < 1e-14;
+}
+
+//  drift-kick-drift leapfrog (Stormer-Verlet), second order
+inline constexpr Scheme<1> leapfrog {{.5, .5}, {1}};
+
+//  three leapfrogs of w1 dt, w0 dt, w1 dt with w1 = 1 / (2 - 2^(1/3)), w0 = 1 - 2 w1 (Forest & Ruth 1990),
+//  fourth order, also the fourth order triple jump of Yoshida 1990
+inline constexpr double w1_4 = 1.3512071919596576340476878089715;
+inline constexpr double w0_4 = 1 - 2 * w1_4;
+inline constexpr Scheme<3> forest_ruth {{.5 * w1_4, .5 * (w0_4 + w1_4), .5 * (w0_4 + w1_4), .5 * w1_4},
+                                        {w1_4, w0_4, w1_4}};
+inline constexpr Scheme<3> yoshida_4 = forest_ruth;
+
+//  seven leapfrogs of w3, w2, w1, w0, w1, w2, w3 times dt, sixth order (Yoshida 1990, solution A)
+inline constexpr double w1_6 = -1.17767998417887;
+inline constexpr double w2_6 = .235573213359357;
+inline constexpr double w3_6 = .784513610477560;
+inline constexpr double w0_6 = 1 - 2 * (w1_6 + w2_6 + w3_6);
+inline constexpr Scheme<7> yoshida_6 {{.5 * w3_6, .5 * (w3_6 + w2_6), .5 * (w2_6 + w1_6), .5 * (w1_6 + w0_6),
+                                       .5 * (w0_6 + w1_6), .5 * (w1_6 + w2_6), .5 * (w2_6 + w3_6), .5 * w3_6},
+                                      {w3_6, w2_6, w1_6, w0_6, w1_6, w2_6, w3_6}};
+
+//  position extended Forest-Ruth like, fourth order with a smaller error constant than forest_ruth
+//  (Omelyan, Mryglod & Folk 2002)
+inline constexpr double xi     = .1786178958448091;
+inline constexpr double lambda = -.2123418310626054;
+inline constexpr double chi    = -.06626458266981849;
+inline constexpr Scheme<4> pefrl {{xi, chi, 1 - 2 * (chi + xi), chi, xi},
+                                  {.5 * (1 - 2 * lambda), lambda, lambda, .5 * (1 - 2 * lambda)}};
+
+static_assert(consistent(leapfrog) && consistent(forest_ruth) && consistent(yoshida_6) && consistent(pefrl));
+
+//  one step of the scheme, drift(h) and kick(h) advance by the substep h
+template <const auto &scheme, typename Drift, typename Kick>
+void compose(const double dt, Drift &&drift, Kick &&kick)
+{
+    for (size_t i = 0; i < scheme.n_kicks; i++)
+    {   drift(scheme.c[i] * dt);
+        kick(scheme.d[i] * dt);
+    }
+    drift(scheme.c[scheme.n_kicks] * dt);
+}
+
+};
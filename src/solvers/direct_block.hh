@@ -0,0 +1,153 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "direct_kernel.hh"
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+namespace Direct_Block
+{
+
+//  individual power of two time steps dt / 2^k, k <= n_levels, with the Aarseth criterion
+//  eta |a| / |da/dt|, where only the bodies due at the next block time get new forces
+//  all bodies are predicted to that time to third order, active ones are corrected to second order:
+//      v1 = v0 + (a0 + a1) dt / 2,  x1 = x0 + (v0 + v1) dt / 2
+//  times are integer ticks of the smallest step, so block times are exact
+
+struct Buffers
+{
+    Direct_Kernel::Soa pos;             // predicted positions and velocities
+    Direct_Kernel::Soa vel;
+    std::vector<double> acc;            // at the last force evaluation of every body
+    std::vector<double> jerk;
+    std::vector<uint64_t> tick;         // time of the last force evaluation
+    std::vector<uint64_t> step;
+    std::vector<size_t> active;
+    uint64_t now = 0;
+    size_t interactions = 0;            // counter, for throughput
+
+    explicit Buffers(const size_t n)
+        : pos {n}, vel {n}, acc(3 * n), jerk(3 * n), tick(n), step(n)
+    {   active.reserve(n);
+    }
+};
+
+//  largest allowed step in ticks, a power of two that divides the current time
+uint64_t choose_step(const double *const a, const double *const j, const uint64_t now, const uint64_t step_old,
+                     const double eta, const double dt_min, const size_t n_levels) noexcept
+{
+    const double a_norm = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    const double j_norm = sqrt(j[0] * j[0] + j[1] * j[1] + j[2] * j[2]);
+    const double dt = j_norm > 0 ? eta * a_norm / j_norm : INFINITY;
+    const uint64_t step_max = uint64_t {1} << n_levels;
+    uint64_t step = 1;
+    while (step < step_max && 2 * step * dt_min <= dt)
+        step *= 2;
+    //  grow at most by 2 per step, and stay commensurate with the block time
+    if (step_old != 0)
+        step = std::min(step, 2 * step_old);
+    while (now % step != 0)
+        step /= 2;
+    return step;
+}
+
+//  forces and steps at the start, dt is the largest step
+void forward_init(const double *const state, Buffers &b, const size_t n,
+                  const double dt, const double eps2, const double eta, const size_t n_levels) noexcept
+{
+    const double dt_min = dt / (uint64_t {1} << n_levels);
+    b.pos.gather(state);
+    b.vel.gather(state + 3 * n);
+    b.now = 0;
+    #pragma omp parallel for default(none) shared(b, n, eps2, eta, n_levels, dt_min)
+    for (size_t i = 0; i < n; i++)
+    {   Direct_Kernel::accelerate_jerk_one(b.pos, b.vel, i, 0, n, eps2, &b.acc[3*i], &b.jerk[3*i]);
+        b.tick[i] = 0;
+        b.step[i] = choose_step(&b.acc[3*i], &b.jerk[3*i], 0, 0, eta, dt_min, n_levels);
+    }
+    b.interactions += n * n;
+}
+
+//  block steps until all bodies are synchronized again, which is after dt, the largest step
+void forward(double *const state, Buffers &b, const size_t n,
+             const double dt, const double eps2, const double eta, const size_t n_levels) noexcept
+{
+    const uint64_t step_max = uint64_t {1} << n_levels;
+    const double dt_min = dt / step_max;
+    const uint64_t end = b.now + step_max;
+    while (b.now < end)
+    {   //  next block time and the bodies due then
+        uint64_t next = end;
+        for (size_t i = 0; i < n; i++)
+            next = std::min(next, b.tick[i] + b.step[i]);
+        b.active.clear();
+        for (size_t i = 0; i < n; i++)
+            if (b.tick[i] + b.step[i] == next)
+                b.active.push_back(i);
+
+        //  predict every body to the block time
+        #pragma omp parallel for default(none) shared(state, b, n, next, dt_min)
+        for (size_t i = 0; i < n; i++)
+        {   const double h = (next - b.tick[i]) * dt_min;
+            const double *const x = state + 3 * i;
+            const double *const v = state + 3 * (i + n);
+            const double *const a = &b.acc[3*i];
+            const double *const j = &b.jerk[3*i];
+            b.pos.x[i] = x[0] + h * (v[0] + h * (.5 * a[0] + h / 6 * j[0]));
+            b.pos.y[i] = x[1] + h * (v[1] + h * (.5 * a[1] + h / 6 * j[1]));
+            b.pos.z[i] = x[2] + h * (v[2] + h * (.5 * a[2] + h / 6 * j[2]));
+            b.vel.x[i] = v[0] + h * (a[0] + .5 * h * j[0]);
+            b.vel.y[i] = v[1] + h * (a[1] + .5 * h * j[1]);
+            b.vel.z[i] = v[2] + h * (a[2] + .5 * h * j[2]);
+        }
+
+        //  new forces on the active bodies and correction
+        const size_t n_active = b.active.size();
+        #pragma omp parallel for default(none) shared(state, b, n, n_active, next, dt_min, eps2, eta, n_levels) schedule(dynamic, 16)
+        for (size_t k = 0; k < n_active; k++)
+        {   const size_t i = b.active[k];
+            double a[3], j[3];
+            Direct_Kernel::accelerate_jerk_one(b.pos, b.vel, i, 0, n, eps2, a, j);
+            const double h = b.step[i] * dt_min;
+            double *const x = state + 3 * i;
+            double *const v = state + 3 * (i + n);
+            for (size_t d = 0; d < 3; d++)
+            {   const double v_new = v[d] + .5 * (b.acc[3*i+d] + a[d]) * h;
+                x[d] += .5 * (v[d] + v_new) * h;
+                v[d] = v_new;
+                b.acc[3*i+d] = a[d];
+                b.jerk[3*i+d] = j[d];
+            }
+            b.tick[i] = next;
+            b.step[i] = choose_step(a, j, next, b.step[i], eta, dt_min, n_levels);
+        }
+        b.interactions += n_active * n;
+        b.now = next;
+    }
+}
+
+};
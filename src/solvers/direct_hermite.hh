@@ -0,0 +1,96 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "direct_kernel.hh"
+#include <vector>
+
+namespace Direct_Hermite
+{
+
+//  fourth order Hermite predictor-corrector (Makino & Aarseth 1992), acceleration and jerk come from
+//  the same pair loop, predicted to third order from the last step:
+//      x_p = x0 + v0 dt + a0 dt^2 / 2 + j0 dt^3 / 6,  v_p = v0 + a0 dt + j0 dt^2 / 2
+//  and after evaluating a1, j1 at the prediction:
+//      v1 = v0 + (a0 + a1) dt / 2 + (j0 - j1) dt^2 / 12,  x1 = x0 + (v0 + v1) dt / 2 + (a0 - a1) dt^2 / 12
+
+struct Buffers
+{
+    Direct_Kernel::Soa pos;             // predicted positions and velocities
+    Direct_Kernel::Soa vel;
+    std::vector<double> acc;            // at the start of the step
+    std::vector<double> jerk;
+
+    explicit Buffers(const size_t n)
+        : pos {n}, vel {n}, acc(3 * n), jerk(3 * n)
+    {}
+};
+
+//  acceleration and jerk of the initial condition
+void forward_init(const double *const state, Buffers &b, const size_t n, const double eps2) noexcept
+{
+    b.pos.gather(state);
+    b.vel.gather(state + 3 * n);
+    #pragma omp parallel for default(none) shared(b, n, eps2)
+    for (size_t i = 0; i < n; i++)
+        Direct_Kernel::accelerate_jerk_one(b.pos, b.vel, i, 0, n, eps2, &b.acc[3*i], &b.jerk[3*i]);
+}
+
+void forward(double *const state, Buffers &b, const size_t n, const double dt, const double eps2) noexcept
+{
+    //  predict
+    #pragma omp parallel for default(none) shared(state, b, n, dt)
+    for (size_t i = 0; i < n; i++)
+    {   const double *const x = state + 3 * i;
+        const double *const v = state + 3 * (i + n);
+        const double *const a = &b.acc[3*i];
+        const double *const j = &b.jerk[3*i];
+        b.pos.x[i] = x[0] + dt * (v[0] + dt * (.5 * a[0] + dt / 6 * j[0]));
+        b.pos.y[i] = x[1] + dt * (v[1] + dt * (.5 * a[1] + dt / 6 * j[1]));
+        b.pos.z[i] = x[2] + dt * (v[2] + dt * (.5 * a[2] + dt / 6 * j[2]));
+        b.vel.x[i] = v[0] + dt * (a[0] + .5 * dt * j[0]);
+        b.vel.y[i] = v[1] + dt * (a[1] + .5 * dt * j[1]);
+        b.vel.z[i] = v[2] + dt * (a[2] + .5 * dt * j[2]);
+    }
+
+    //  evaluate and correct, the pair loop only reads the predicted buffers
+    #pragma omp parallel for default(none) shared(state, b, n, dt, eps2)
+    for (size_t i = 0; i < n; i++)
+    {   double a[3], j[3];
+        Direct_Kernel::accelerate_jerk_one(b.pos, b.vel, i, 0, n, eps2, a, j);
+        double *const x = state + 3 * i;
+        double *const v = state + 3 * (i + n);
+        for (size_t d = 0; d < 3; d++)
+        {   const double a0 = b.acc[3*i+d];
+            const double j0 = b.jerk[3*i+d];
+            const double v_new = v[d] + .5 * (a0 + a[d]) * dt + (j0 - j[d]) * dt * dt / 12;
+            x[d] += .5 * (v[d] + v_new) * dt + (a0 - a[d]) * dt * dt / 12;
+            v[d] = v_new;
+            b.acc[3*i+d] = a[d];
+            b.jerk[3*i+d] = j[d];
+        }
+    }
+}
+
+};
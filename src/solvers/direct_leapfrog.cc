@@ -25,7 +25,14 @@
 #include "direct_leapfrog.hh"
 #include "n_body_h5.hh"
 #include "n_body_vtu.hh"
+#include "async_writer.hh"
+#include "checkpoint.hh"
+#include "series_h5.hh"
+#include "diagnostics.hh"
 #include <cstdio>
+#include <cstring>
+#include <optional>
+#include <omp.h>
 
 int main()
 {
@@ -33,30 +40,90 @@ int main()
     /* steps between process */ constexpr size_t n_s = 2000;
     /* time step             */ constexpr double dt   = 1e-6;
     /* softening eps^2       */ constexpr double eps2 = 3e-5;
+    /* pairs evaluated once  */ constexpr bool symmetric = true;
+    /* separation precision  */ using Real = double;
     /* h5 file with ic       */ Storage::N_Body_vtu<10000> storage {"king"};
                                 size_t n = storage.n_objects();
     /* integrator memory     */ auto *state = new double[6 * n];
+                                Direct_Leapfrog::Buffers<Real> buffers {n};
     /* store vel also?       */ constexpr bool store_velocities = true;
+    /* diagnostics memory    */ Diagnostics::Buffers diagnostics {n};
+                                Diagnostics::Record record;
+                                std::optional<Storage::Series_h5> series;
+    /* checkpoint every (s)  */ Storage::Checkpoint checkpoint {"king_direct_leapfrog", 1800};
 
-    //  read ic, pos and vel
-    storage.read(state, state + 3 * n);
+    //  read ic, pos and vel, or resume from the last checkpoint, which has the state and the cursors of the
+    //  storage and of the diagnostics series
+    size_t cursor = 0;
+    Storage::Series_h5::Cursor series_cursor {};
+    uint64_t s_0 = 0;
+    const bool resumed = checkpoint.load(s_0, {Storage::Checkpoint::block(state, 6 * n),
+                                               Storage::Checkpoint::block(&cursor),
+                                               Storage::Checkpoint::block(&series_cursor)});
+    if (resumed)
+    {   storage.resume(state, state + 3 * n, cursor);
+        series.emplace("king_direct_leapfrog_diagnostics", "diagnostics", Diagnostics::n_columns, series_cursor);
+    }
+    else
+    {   storage.read(state, state + 3 * n);
+        series.emplace("king_direct_leapfrog_diagnostics", "diagnostics", Diagnostics::names, Diagnostics::n_columns);
+    }
 
     //  vel buffer was set by 'read', so need explicit 'no_vel' to not update
     if constexpr (!store_velocities)
         storage.no_vel();
 
-    //  process state function
+    //  snapshots are written on a background thread, the integrator stores straight into a free slot,
+    //  each snapshot is followed by its row of diagnostics, which go to the series
+    Storage::Async_Writer<> writer {6 * n + Diagnostics::n_columns, [&](double *const snapshot, const double t)
+    {   if constexpr (store_velocities)
+            storage.set_buffers(snapshot, snapshot + 3 * n);
+        else
+            storage.set_buffer(snapshot);
+        storage.write(t);
+        series->write(snapshot + 6 * n);
+    }};
+    double *snapshot = nullptr;
+
+    //  process state function, with the force throughput since the last and the diagnostics, and checkpoint when due
+    double time = omp_get_wtime();
     auto process = [&](size_t s)
-    {   storage.write(s * dt);
-        printf("{%zu}/{%zu}\n", s, n_t);
+    {   const double rate = n_s * static_cast<double>(n) * n / (omp_get_wtime() - time);
+        memcpy(snapshot + 6 * n, &record, sizeof(record));
+        writer.submit(s * dt);
+        printf("{%zu}/{%zu} %.3e interactions/s, energy %.15e\n", s, n_t, rate, record.kinetic + record.potential);
+        if (checkpoint.due(s))
+        {   writer.flush();
+            cursor = storage.cursor();
+            series_cursor = series->cursor();
+            checkpoint.save(s, {Storage::Checkpoint::block(snapshot, 6 * n),
+                                Storage::Checkpoint::block(&cursor),
+                                Storage::Checkpoint::block(&series_cursor)});
+        }
+        time = omp_get_wtime();
     };
 
-    //  main loop
-    for (size_t s = 1; s <= n_t; s++)
-    {   Direct_Leapfrog::forward(state, n, dt, eps2);
-        if (s % n_s == 0)
-            process(s);
+    //  main loop, one thread team for the whole run, the state is only synced for output
+    #pragma omp parallel
+    {
+        Direct_Leapfrog::load(state, buffers, n);
+        for (size_t s = s_0 + 1; s <= n_t; s++)
+        {   Direct_Leapfrog::forward<symmetric>(buffers, n, dt, eps2);
+            if (s % n_s == 0)
+            {
+                #pragma omp single
+                snapshot = writer.acquire();
+                Direct_Leapfrog::store(buffers, snapshot, n);
+                Diagnostics::measure(snapshot, snapshot + 3 * n, diagnostics, 1, 1, eps2, s * dt, record);
+                #pragma omp single
+                process(s);
+            }
+        }
     }
 
+    //  the run completed, its checkpoint is dropped once the last snapshots are written
+    writer.flush();
+    checkpoint.remove();
+
     delete[] state;
 }
@@ -23,39 +23,93 @@
 */
 
 #pragma once
+#include "direct_kernel.hh"
 #include <cmath>
+#include <type_traits>
+#include <utility>
 
 namespace Direct_Leapfrog
 {
 
-void forward(double *const state, const size_t n,
-             const double dt, const double eps2) noexcept
+//  integration state as SoA, with double buffered positions: the force phase only reads *pos and
+//  the update phase only writes *pos_next, so a thread updates its bodies as soon as their forces
+//  are done, without waiting on the other threads still reading positions, and the buffers are
+//  swapped at the end of the step
+//  T = float selects the mixed precision kernel, with a float copy of the positions
+template <typename T = double>
+struct Buffers
 {
-    #pragma omp parallel for default(none) shared(n, state, eps2, dt)
-    for (size_t i = 0; i < n; i++)
-    {   double a1 = 0;
-        double a2 = 0;
-        double a3 = 0;
-        for (size_t j = 0; j < n; j++)
-            if (i != j)
-            {   const double b1 = state[3*i  ] - state[3*j  ];
-                const double b2 = state[3*i+1] - state[3*j+1];
-                const double b3 = state[3*i+2] - state[3*j+2];
-                double c = 1 / sqrt(b1 * b1 +
-                                    b2 * b2 +
-                                    b3 * b3 + eps2);
-                c = c * c * c;
-                a1 -= c * b1;
-                a2 -= c * b2;
-                a3 -= c * b3;
-            }
-        state[3*(i+n)  ] += a1 * dt;
-        state[3*(i+n)+1] += a2 * dt;
-        state[3*(i+n)+2] += a3 * dt;
-        state[3*i  ] += state[3*(i+n)  ] * dt;
-        state[3*i+1] += state[3*(i+n)+1] * dt;
-        state[3*i+2] += state[3*(i+n)+2] * dt;
+    Direct_Kernel::Soa pos_0;
+    Direct_Kernel::Soa pos_1;
+    Direct_Kernel::Soa vel;
+    Direct_Kernel::Soa acc;
+    Direct_Kernel::Basic_Soa<T> pos_t;  // empty for double
+    Direct_Kernel::Soa *pos = &pos_0;
+    Direct_Kernel::Soa *pos_next = &pos_1;
+
+    explicit Buffers(const size_t n)
+        : pos_0 {n}, pos_1 {n}, vel {n}, acc {n}, pos_t {std::is_same_v<T, double> ? 0 : n}
+    {}
+};
+
+//  from and to the interleaved state, pos (3 n) then vel (3 n), the state is only needed for output
+template <typename T>
+void load(const double *const state, Buffers<T> &b, const size_t n) noexcept
+{
+    b.pos->gather(state);
+    b.vel.gather(state + 3 * n);
+}
+
+template <typename T>
+void store(const Buffers<T> &b, double *const state, const size_t n) noexcept
+{
+    b.pos->scatter(state);
+    b.vel.scatter(state + 3 * n);
+}
+
+//  called by every thread of a parallel region, the phases are separated by the implicit barriers
+//  symmetric evaluates every pair once, see Direct_Kernel::accelerate_symmetric, there forces are only
+//  final after all tiles, so the update is a phase of its own
+template <bool symmetric = false, typename T>
+void forward(Buffers<T> &b, const size_t n, const double dt, const double eps2) noexcept
+{
+    static_assert(!symmetric || std::is_same_v<T, double>);
+    const Direct_Kernel::Soa &pos = *b.pos;
+    Direct_Kernel::Soa &next = *b.pos_next;
+    Direct_Kernel::Soa &vel = b.vel;
+    Direct_Kernel::Soa &acc = b.acc;
+    auto update = [&](const size_t i_begin, const size_t i_end)
+    {   for (size_t i = i_begin; i < i_end; i++)
+        {   vel.x[i] += acc.x[i] * dt;
+            vel.y[i] += acc.y[i] * dt;
+            vel.z[i] += acc.z[i] * dt;
+            next.x[i] = pos.x[i] + vel.x[i] * dt;
+            next.y[i] = pos.y[i] + vel.y[i] * dt;
+            next.z[i] = pos.z[i] + vel.z[i] * dt;
+        }
+    };
+
+    if constexpr (symmetric)
+    {   Direct_Kernel::accelerate_symmetric(pos, acc, eps2);
+        #pragma omp for
+        for (size_t i = 0; i < n; i++)
+            update(i, i + 1);
+    }
+    else if constexpr (std::is_same_v<T, double>)
+        Direct_Kernel::accelerate_then(pos, acc, eps2, update);
+    else
+    {
+        #pragma omp for
+        for (size_t i = 0; i < n; i++)
+        {   b.pos_t.x[i] = static_cast<T>(pos.x[i]);
+            b.pos_t.y[i] = static_cast<T>(pos.y[i]);
+            b.pos_t.z[i] = static_cast<T>(pos.z[i]);
+        }
+        Direct_Kernel::accelerate_then(b.pos_t, acc, eps2, update);
     }
+
+    #pragma omp single
+    std::swap(b.pos, b.pos_next);
 }
 
 };
@@ -0,0 +1,144 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "direct_mpi.hh"
+#include "n_body_h5.hh"
+#include "async_writer.hh"
+#include "diagnostics.hh"
+#include "checkpoint.hh"
+#include "series_h5.hh"
+#include <mpi.h>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+
+//  e.g. mpirun -n 4 ./direct_mpi, with OMP_NUM_THREADS set to the cores per rank
+
+int main(int argc, char **argv)
+{
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    if (provided < MPI_THREAD_FUNNELED)
+    {   fprintf(stderr, "MPI library does not support MPI_THREAD_FUNNELED, needed for the OpenMP threads\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    /* number of time steps  */ constexpr size_t n_t = 10000000;
+    /* steps between process */ constexpr size_t n_s = 2000;
+    /* time step             */ constexpr double dt   = 1e-6;
+    /* softening eps^2       */ constexpr double eps2 = 3e-5;
+    /* h5 file with ic       */ std::optional<Storage::N_Body_h5<>> storage;
+    /* on rank 0 only        */ int rank;
+                                MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+                                if (rank == 0)
+                                    storage.emplace("king");
+                                unsigned long long n = rank == 0 ? storage->n_objects() : 0;
+                                MPI_Bcast(&n, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    /* integrator memory     */ Direct_Mpi::Ring ring {n, MPI_COMM_WORLD};
+                                auto *state = new double[6 * ring.n_local()];
+                                auto *full_state = rank == 0 ? new double[6 * n] : nullptr;
+    /* diagnostics memory    */ std::optional<Diagnostics::Buffers> diagnostics;
+                                if (rank == 0)
+                                    diagnostics.emplace(n);
+                                auto *phi = new double[ring.n_local()];
+                                std::optional<Storage::Series_h5> series;
+    /* checkpoint every (s)  */ Storage::Checkpoint checkpoint {"king_direct_mpi", 1800};
+
+    //  read ic, pos and vel, or resume from the last checkpoint, which rank 0 keeps, with the gathered state
+    //  and the cursors of the storage and of the diagnostics series
+    Storage::N_Body_h5<>::Cursor cursor {};
+    Storage::Series_h5::Cursor series_cursor {};
+    uint64_t s_0 = 0;
+    if (rank == 0)
+    {   if (checkpoint.load(s_0, {Storage::Checkpoint::block(full_state, 6 * n),
+                                  Storage::Checkpoint::block(&cursor),
+                                  Storage::Checkpoint::block(&series_cursor)}))
+        {   storage->seek(cursor);
+            series.emplace(storage->file, "diagnostics", Diagnostics::n_columns, series_cursor);
+        }
+        else
+        {   storage->read(full_state, full_state + 3 * n);
+            series.emplace(storage->file, "diagnostics", Diagnostics::names, Diagnostics::n_columns);
+        }
+    }
+    MPI_Bcast(&s_0, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    Direct_Mpi::scatter(full_state, state, ring);
+
+    //  rank 0 writes snapshots on a background thread, from copies of the gathered state,
+    //  each followed by its row of diagnostics, which go to a series in the same file
+    std::optional<Storage::Async_Writer<>> writer;
+    if (rank == 0)
+        writer.emplace(6 * n + Diagnostics::n_columns, [&](double *const snapshot, const double t)
+        {   storage->write(snapshot, snapshot + 3 * n, t);
+            series->write(snapshot + 6 * n);
+        });
+
+    //  process state function, with the force throughput since the last, and the diagnostics, whose potentials
+    //  are summed by a ring pass over all ranks, rank 0 checkpoints the gathered state when due
+    double time = MPI_Wtime();
+    auto process = [&](size_t s)
+    {   const double rate = n_s * static_cast<double>(n) * n / (MPI_Wtime() - time);
+        Direct_Mpi::potentials(state, ring, eps2, phi, rank == 0 ? diagnostics->phi.data() : nullptr);
+        Direct_Mpi::gather(state, full_state, ring);
+        if (rank == 0)
+        {   Diagnostics::Record record;
+            #pragma omp parallel
+            Diagnostics::measure(full_state, full_state + 3 * n, diagnostics->phi.data(), *diagnostics, 1, 1, s * dt,
+                                 record);
+            double *const snapshot = writer->acquire();
+            memcpy(snapshot, full_state, 6 * n * sizeof(double));
+            memcpy(snapshot + 6 * n, &record, sizeof(record));
+            writer->submit(s * dt);
+            printf("{%zu}/{%zu} %.3e interactions/s, energy %.15e\n", s, n_t, rate, record.kinetic + record.potential);
+            if (checkpoint.due(s))
+            {   writer->flush();
+                cursor = storage->cursor();
+                series_cursor = series->cursor();
+                checkpoint.save(s, {Storage::Checkpoint::block(full_state, 6 * n),
+                                    Storage::Checkpoint::block(&cursor),
+                                    Storage::Checkpoint::block(&series_cursor)});
+            }
+        }
+        time = MPI_Wtime();
+    };
+
+    //  main loop
+    for (size_t s = s_0 + 1; s <= n_t; s++)
+    {   Direct_Mpi::forward(state, ring, dt, eps2);
+        if (s % n_s == 0)
+            process(s);
+    }
+
+    //  the run completed, its checkpoint is dropped once the last snapshots are written and flushed
+    if (rank == 0)
+    {   writer->flush();
+        storage->flush();
+        checkpoint.remove();
+    }
+    writer.reset();
+    delete[] phi;
+    delete[] state;
+    delete[] full_state;
+    MPI_Finalize();
+}
@@ -0,0 +1,217 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "direct_kernel.hh"
+#include <mpi.h>
+#include <utility>
+#include <vector>
+
+namespace Direct_Mpi
+{
+
+//  bodies are split in contiguous blocks over the ranks, sizes differing by at most one
+//  every force evaluation, the position blocks travel around the ring of ranks, each rank receives
+//  the next block from its left neighbour while computing the forces of the current block on its own bodies
+//  the state of a rank is its own bodies only, in the same layout as the full state: pos (3 n_local), vel
+
+struct Ring
+{
+    MPI_Comm comm;
+    int rank;
+    int size;
+    size_t n;                   // total # bodies
+    std::vector<int> counts;    // # bodies per rank
+    std::vector<int> offsets;   // first body per rank
+    Direct_Kernel::Soa block_0; // ring buffers, of the largest block size
+    Direct_Kernel::Soa block_1;
+    Direct_Kernel::Soa acc;
+
+    Ring(const size_t n, const MPI_Comm comm)
+        : comm {comm}, rank {rank_of(comm)}, size {size_of(comm)}, n {n},
+          counts(size), offsets(size),
+          block_0 {(n + size - 1) / size}, block_1 {(n + size - 1) / size}, acc {n_local_of(n, rank, size)}
+    {   for (int r = 0; r < size; r++)
+        {   counts[r] = static_cast<int>(n_local_of(n, r, size));
+            offsets[r] = r == 0 ? 0 : offsets[r-1] + counts[r-1];
+        }
+    }
+
+    size_t n_local() const noexcept
+    {   return counts[rank];
+    }
+
+    static int rank_of(const MPI_Comm comm) noexcept
+    {   int rank;
+        MPI_Comm_rank(comm, &rank);
+        return rank;
+    }
+
+    static int size_of(const MPI_Comm comm) noexcept
+    {   int size;
+        MPI_Comm_size(comm, &size);
+        return size;
+    }
+
+    static size_t n_local_of(const size_t n, const int rank, const int size) noexcept
+    {   return n / size + (static_cast<size_t>(rank) < n % size);
+    }
+};
+
+//  full state on rank 0 to the local states, and back
+void scatter(const double *const full_state, double *const state, const Ring &ring) noexcept
+{
+    std::vector<int> counts(ring.size);
+    std::vector<int> offsets(ring.size);
+    for (int r = 0; r < ring.size; r++)
+    {   counts[r] = 3 * ring.counts[r];
+        offsets[r] = 3 * ring.offsets[r];
+    }
+    const int n_local = 3 * ring.counts[ring.rank];
+    MPI_Scatterv(full_state, counts.data(), offsets.data(), MPI_DOUBLE, state, n_local, MPI_DOUBLE, 0, ring.comm);
+    MPI_Scatterv(ring.rank == 0 ? full_state + 3 * ring.n : nullptr, counts.data(), offsets.data(), MPI_DOUBLE,
+                 state + n_local, n_local, MPI_DOUBLE, 0, ring.comm);
+}
+
+void gather(const double *const state, double *const full_state, const Ring &ring) noexcept
+{
+    std::vector<int> counts(ring.size);
+    std::vector<int> offsets(ring.size);
+    for (int r = 0; r < ring.size; r++)
+    {   counts[r] = 3 * ring.counts[r];
+        offsets[r] = 3 * ring.offsets[r];
+    }
+    const int n_local = 3 * ring.counts[ring.rank];
+    MPI_Gatherv(state, n_local, MPI_DOUBLE, full_state, counts.data(), offsets.data(), MPI_DOUBLE, 0, ring.comm);
+    MPI_Gatherv(state + n_local, n_local, MPI_DOUBLE, ring.rank == 0 ? full_state + 3 * ring.n : nullptr,
+                counts.data(), offsets.data(), MPI_DOUBLE, 0, ring.comm);
+}
+
+//  same kick-drift step as Direct_Leapfrog, on the local bodies
+void forward(double *const state, Ring &ring, const double dt, const double eps2) noexcept
+{
+    const size_t n = ring.n_local();
+    const int left = (ring.rank + ring.size - 1) % ring.size;
+    const int right = (ring.rank + 1) % ring.size;
+    const int message_size = static_cast<int>(3 * ring.block_0.n_pad);
+    Direct_Kernel::Soa *current = &ring.block_0;
+    Direct_Kernel::Soa *next = &ring.block_1;
+    Direct_Kernel::Soa &acc = ring.acc;
+
+    //  own block first
+    #pragma omp parallel for default(none) shared(n, state, current, acc)
+    for (size_t i = 0; i < n; i++)
+    {   current->x[i] = state[3*i  ];
+        current->y[i] = state[3*i+1];
+        current->z[i] = state[3*i+2];
+        acc.x[i] = 0;
+        acc.y[i] = 0;
+        acc.z[i] = 0;
+    }
+
+    for (int k = 0; k < ring.size; k++)
+    {   const int owner = (ring.rank + ring.size - k) % ring.size;
+        const size_t m = ring.counts[owner];
+        MPI_Request requests[2];
+        if (k + 1 < ring.size)
+        {   MPI_Irecv(next->x, message_size, MPI_DOUBLE, left, k, ring.comm, &requests[0]);
+            MPI_Isend(current->x, message_size, MPI_DOUBLE, right, k, ring.comm, &requests[1]);
+        }
+
+        #pragma omp parallel for default(none) shared(n, m, state, current, acc, eps2)
+        for (size_t i = 0; i < n; i++)
+            Direct_Kernel::accelerate_point(state[3*i], state[3*i+1], state[3*i+2], *current, 0, m,
+                                            eps2, acc.x[i], acc.y[i], acc.z[i]);
+
+        if (k + 1 < ring.size)
+        {   MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+            std::swap(current, next);
+        }
+    }
+
+    #pragma omp parallel for default(none) shared(n, state, acc, dt)
+    for (size_t i = 0; i < n; i++)
+    {   state[3*(i+n)  ] += acc.x[i] * dt;
+        state[3*(i+n)+1] += acc.y[i] * dt;
+        state[3*(i+n)+2] += acc.z[i] * dt;
+        state[3*i  ] += state[3*(i+n)  ] * dt;
+        state[3*i+1] += state[3*(i+n)+1] * dt;
+        state[3*i+2] += state[3*(i+n)+2] * dt;
+    }
+}
+
+//  per body sums of the softened 1 / r over the other bodies, for the local bodies into phi, by the same ring
+//  pass as forward, and all of them to full_phi on rank 0, like the diagnostics need
+void potentials(const double *const state, Ring &ring, const double eps2, double *const phi,
+                double *const full_phi) noexcept
+{
+    const size_t n = ring.n_local();
+    const int left = (ring.rank + ring.size - 1) % ring.size;
+    const int right = (ring.rank + 1) % ring.size;
+    const int message_size = static_cast<int>(3 * ring.block_0.n_pad);
+    Direct_Kernel::Soa *current = &ring.block_0;
+    Direct_Kernel::Soa *next = &ring.block_1;
+
+    //  own block first
+    #pragma omp parallel for default(none) shared(n, state, current, phi)
+    for (size_t i = 0; i < n; i++)
+    {   current->x[i] = state[3*i  ];
+        current->y[i] = state[3*i+1];
+        current->z[i] = state[3*i+2];
+        phi[i] = 0;
+    }
+
+    for (int k = 0; k < ring.size; k++)
+    {   const int owner = (ring.rank + ring.size - k) % ring.size;
+        const size_t m = ring.counts[owner];
+        MPI_Request requests[2];
+        if (k + 1 < ring.size)
+        {   MPI_Irecv(next->x, message_size, MPI_DOUBLE, left, k, ring.comm, &requests[0]);
+            MPI_Isend(current->x, message_size, MPI_DOUBLE, right, k, ring.comm, &requests[1]);
+        }
+
+        //  in the own block, body i itself is left out
+        #pragma omp parallel for default(none) shared(n, m, k, state, current, phi, eps2)
+        for (size_t i = 0; i < n; i++)
+        {   const double x = state[3*i  ];
+            const double y = state[3*i+1];
+            const double z = state[3*i+2];
+            if (k == 0)
+                phi[i] += Direct_Kernel::potential_point(x, y, z, *current, 0, i, eps2)
+                        + Direct_Kernel::potential_point(x, y, z, *current, i + 1, m, eps2);
+            else
+                phi[i] += Direct_Kernel::potential_point(x, y, z, *current, 0, m, eps2);
+        }
+
+        if (k + 1 < ring.size)
+        {   MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+            std::swap(current, next);
+        }
+    }
+
+    MPI_Gatherv(phi, static_cast<int>(n), MPI_DOUBLE, full_phi, ring.counts.data(), ring.offsets.data(),
+                MPI_DOUBLE, 0, ring.comm);
+}
+
+};
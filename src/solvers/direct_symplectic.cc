@@ -0,0 +1,126 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "direct_symplectic.hh"
+#include "n_body_h5.hh"
+#include "n_body_vtu.hh"
+#include "async_writer.hh"
+#include "checkpoint.hh"
+#include "series_h5.hh"
+#include "diagnostics.hh"
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <omp.h>
+
+int main()
+{
+    /* number of time steps  */ constexpr size_t n_t = 1000000;
+    /* steps between process */ constexpr size_t n_s = 200;
+    /* time step             */ constexpr double dt   = 1e-5;
+    /* softening eps^2       */ constexpr double eps2 = 3e-5;
+    /* splitting scheme      */ constexpr auto &scheme = Splitting::pefrl;
+    /* pairs evaluated once  */ constexpr bool symmetric = true;
+    /* separation precision  */ using Real = double;
+    /* h5 file with ic       */ Storage::N_Body_vtu<10000> storage {"king"};
+                                size_t n = storage.n_objects();
+    /* integrator memory     */ auto *state = new double[6 * n];
+                                Direct_Kernel::Basic_Soa<Real> pos {n};
+                                Direct_Kernel::Soa acc {n};
+    /* store vel also?       */ constexpr bool store_velocities = true;
+    /* diagnostics memory    */ Diagnostics::Buffers diagnostics {n};
+                                Diagnostics::Record record;
+                                std::optional<Storage::Series_h5> series;
+    /* checkpoint every (s)  */ Storage::Checkpoint checkpoint {"king_direct_symplectic", 1800};
+
+    //  read ic, pos and vel, or resume from the last checkpoint, which has the state and the cursors of the
+    //  storage and of the diagnostics series
+    size_t cursor = 0;
+    Storage::Series_h5::Cursor series_cursor {};
+    uint64_t s_0 = 0;
+    const bool resumed = checkpoint.load(s_0, {Storage::Checkpoint::block(state, 6 * n),
+                                               Storage::Checkpoint::block(&cursor),
+                                               Storage::Checkpoint::block(&series_cursor)});
+    if (resumed)
+    {   storage.resume(state, state + 3 * n, cursor);
+        series.emplace("king_direct_symplectic_diagnostics", "diagnostics", Diagnostics::n_columns, series_cursor);
+    }
+    else
+    {   storage.read(state, state + 3 * n);
+        series.emplace("king_direct_symplectic_diagnostics", "diagnostics", Diagnostics::names, Diagnostics::n_columns);
+    }
+
+    //  vel buffer was set by 'read', so need explicit 'no_vel' to not update
+    if constexpr (!store_velocities)
+        storage.no_vel();
+
+    //  snapshots are written on a background thread, from copies of the state,
+    //  each followed by its row of diagnostics, which go to the series
+    const size_t snapshot_size = (store_velocities ? 6 : 3) * n;
+    Storage::Async_Writer<> writer {snapshot_size + Diagnostics::n_columns, [&](double *const snapshot, const double t)
+    {   if constexpr (store_velocities)
+            storage.set_buffers(snapshot, snapshot + 3 * n);
+        else
+            storage.set_buffer(snapshot);
+        storage.write(t);
+        series->write(snapshot + snapshot_size);
+    }};
+
+    //  process state function, with the force throughput since the last and the diagnostics, and checkpoint when due
+    double time = omp_get_wtime();
+    auto process = [&](size_t s)
+    {   const double rate = n_s * scheme.n_kicks * static_cast<double>(n) * n / (omp_get_wtime() - time);
+        double *const snapshot = writer.acquire();
+        memcpy(snapshot, state, snapshot_size * sizeof(double));
+        memcpy(snapshot + snapshot_size, &record, sizeof(record));
+        writer.submit(s * dt);
+        printf("{%zu}/{%zu} %.3e interactions/s, energy %.15e\n", s, n_t, rate, record.kinetic + record.potential);
+        if (checkpoint.due(s))
+        {   writer.flush();
+            cursor = storage.cursor();
+            series_cursor = series->cursor();
+            checkpoint.save(s, {Storage::Checkpoint::block(state, 6 * n),
+                                Storage::Checkpoint::block(&cursor),
+                                Storage::Checkpoint::block(&series_cursor)});
+        }
+        time = omp_get_wtime();
+    };
+
+    //  main loop, one thread team for the whole run
+    #pragma omp parallel
+    for (size_t s = s_0 + 1; s <= n_t; s++)
+    {   Direct_Symplectic::forward<scheme, symmetric>(state, pos, acc, n, dt, eps2);
+        if (s % n_s == 0)
+        {   Diagnostics::measure(state, state + 3 * n, diagnostics, 1, 1, eps2, s * dt, record);
+            #pragma omp single
+            process(s);
+        }
+    }
+
+    //  the run completed, its checkpoint is dropped once the last snapshots are written
+    writer.flush();
+    checkpoint.remove();
+
+    delete[] state;
+}
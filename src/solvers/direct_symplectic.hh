@@ -0,0 +1,74 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "direct_kernel.hh"
+#include "splitting.hh"
+#include <type_traits>
+
+namespace Direct_Symplectic
+{
+
+//  drift, kick and forward are called by every thread of a parallel region, see Direct_Kernel
+
+//  x += h v
+void drift(double *const state, const size_t n, const double h) noexcept
+{
+    #pragma omp for
+    for (size_t i = 0; i < 3 * n; i++)
+        state[i] += state[i+3*n] * h;
+}
+
+//  v += h a(x), the kernel choice is the same as for Direct_Leapfrog::forward
+template <bool symmetric = false, typename T>
+void kick(double *const state, Direct_Kernel::Basic_Soa<T> &pos, Direct_Kernel::Soa &acc,
+          const size_t n, const double h, const double eps2) noexcept
+{
+    pos.gather(state);
+    static_assert(!symmetric || std::is_same_v<T, double>);
+    if constexpr (symmetric)
+        Direct_Kernel::accelerate_symmetric(pos, acc, eps2);
+    else
+        Direct_Kernel::accelerate(pos, acc, eps2);
+
+    #pragma omp for
+    for (size_t i = 0; i < n; i++)
+    {   state[3*(i+n)  ] += acc.x[i] * h;
+        state[3*(i+n)+1] += acc.y[i] * h;
+        state[3*(i+n)+2] += acc.z[i] * h;
+    }
+}
+
+//  one step of a splitting scheme, e.g. forward<Splitting::pefrl>, scheme.n_kicks force evaluations
+//  pos and acc are work buffers of n bodies, kept between steps
+template <const auto &scheme, bool symmetric = false, typename T>
+void forward(double *const state, Direct_Kernel::Basic_Soa<T> &pos, Direct_Kernel::Soa &acc,
+             const size_t n, const double dt, const double eps2) noexcept
+{
+    Splitting::compose<scheme>(dt,
+        [&](const double h) { drift(state, n, h); },
+        [&](const double h) { kick<symmetric>(state, pos, acc, n, h, eps2); });
+}
+
+};
@@ -24,6 +24,14 @@
 
 #include "direct_verlet.hh"
 #include "n_body_h5.hh"
+#include "async_writer.hh"
+#include "checkpoint.hh"
+#include "series_h5.hh"
+#include "diagnostics.hh"
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <omp.h>
 
 int main()
 {
@@ -31,37 +39,109 @@ int main()
     /* steps between process */ constexpr size_t n_s = 1000;
     /* time step             */ constexpr double dt   = 1e-5;
     /* softening eps ^2      */ constexpr double eps2 = 3e-5;
+    /* pairs evaluated once  */ constexpr bool symmetric = true;
+    /* separation precision  */ using Real = double;
     /* h5 file with ic       */ Storage::N_Body_h5 storage {"king"};
                                 size_t n = storage.n_objects();
     /* integrator memory     */ auto *ic    = new double[6 * n];
                                 auto *state = new double[6 * n];
+                                Direct_Kernel::Basic_Soa<Real> pos {n};
+                                Direct_Kernel::Soa acc {n};
     /* store vel also?       */ constexpr bool store_velocities = false;
+    /* diagnostics memory    */ Diagnostics::Buffers diagnostics {n};
+                                Diagnostics::Record record;
+                                auto *vel = new double[3 * n];
+                                std::optional<Storage::Series_h5> series;
+    /* checkpoint every (s)  */ Storage::Checkpoint checkpoint {"king_direct_verlet", 1800};
 
     //  read ic, pos and vel
     storage.read(ic, ic + 3 * n);
 
-    //  process state # s
-    auto process = [&](size_t s)
+    //  snapshots are written on a background thread, from copies of the positions and velocities,
+    //  each followed by its row of diagnostics, which go to a series in the same file
+    const size_t snapshot_size = (store_velocities ? 6 : 3) * n;
+    Storage::Async_Writer<> writer {snapshot_size + Diagnostics::n_columns, [&](double *const snapshot, const double t)
     {   if constexpr (store_velocities)
-            storage.write(state, state + 3 * n, s * dt);
+            storage.write(snapshot, snapshot + 3 * n, t);
         else
-            storage.write(state, s * dt);
-        printf("{%zu}/{%zu}\n", s, n_t);
+            storage.write(snapshot, t);
+        series->write(snapshot + snapshot_size);
+    }};
+
+    //  resume from the last checkpoint if there is one, the state includes the previous positions,
+    //  snapshots and diagnostics stored after the checkpoint are dropped and written again
+    decltype(storage)::Cursor cursor;
+    Storage::Series_h5::Cursor series_cursor {};
+    uint64_t s_0 = 1;
+    const bool resumed = checkpoint.load(s_0, {Storage::Checkpoint::block(state, 6 * n),
+                                               Storage::Checkpoint::block(&cursor),
+                                               Storage::Checkpoint::block(&series_cursor)});
+    if (resumed)
+    {   storage.seek(cursor);
+        series.emplace(storage.file, "diagnostics", Diagnostics::n_columns, series_cursor);
+    }
+    else
+        series.emplace(storage.file, "diagnostics", Diagnostics::names, Diagnostics::n_columns);
+
+    //  diagnostics of state # s, by every thread of the team
+    auto measure = [&](size_t s)
+    {   Direct_Verlet::velocities(state, acc, vel, n, dt);
+        Diagnostics::measure(state, vel, diagnostics, 1, 1, eps2, s * dt, record);
     };
 
-    //  initialization step
-    Direct_Verlet::forward_init(ic, state, n, dt, eps2);
-    if (n_s == 1)
-        process(1);
+    //  process state # s, with the force throughput since the last, and checkpoint when due
+    double time = omp_get_wtime();
+    auto process = [&](size_t s)
+    {   const double rate = n_s * static_cast<double>(n) * n / (omp_get_wtime() - time);
+        double *const snapshot = writer.acquire();
+        memcpy(snapshot, state, 3 * n * sizeof(double));
+        if constexpr (store_velocities)
+            memcpy(snapshot + 3 * n, vel, 3 * n * sizeof(double));
+        memcpy(snapshot + snapshot_size, &record, sizeof(record));
+        writer.submit(s * dt);
+        printf("{%zu}/{%zu} %.3e interactions/s, energy %.15e\n", s, n_t, rate, record.kinetic + record.potential);
+        if (checkpoint.due(s))
+        {   writer.flush();
+            cursor = storage.cursor();
+            series_cursor = series->cursor();
+            checkpoint.save(s, {Storage::Checkpoint::block(state, 6 * n),
+                                Storage::Checkpoint::block(&cursor),
+                                Storage::Checkpoint::block(&series_cursor)});
+        }
+        time = omp_get_wtime();
+    };
 
-    delete[] ic;
+    //  one thread team for the whole run
+    #pragma omp parallel
+    {
+        //  initialization step, unless resuming
+        if (!resumed)
+        {   Direct_Verlet::forward_init<symmetric>(ic, state, pos, acc, n, dt, eps2);
+            if (n_s == 1)
+            {   measure(1);
+                #pragma omp single
+                process(1);
+            }
+        }
+        #pragma omp single nowait
+        delete[] ic;
 
-    //  main loop
-    for (size_t s = 2; s <= n_t; s++)
-    {   Direct_Verlet::forward(state, n, dt, eps2);
-        if (s % n_s == 0)
-            process(s);
+        //  main loop
+        for (size_t s = s_0 + 1; s <= n_t; s++)
+        {   Direct_Verlet::forward<symmetric>(state, pos, acc, n, dt, eps2);
+            if (s % n_s == 0)
+            {   measure(s);
+                #pragma omp single
+                process(s);
+            }
+        }
     }
 
+    //  the run completed, its checkpoint is dropped once the last snapshots are written and flushed
+    writer.flush();
+    storage.flush();
+    checkpoint.remove();
+
+    delete[] vel;
     delete[] state;
 }
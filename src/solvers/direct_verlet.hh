@@ -23,73 +23,76 @@
 */
 
 #pragma once
+#include "direct_kernel.hh"
 #include <cmath>
-#include <cstring>
+#include <type_traits>
 
 namespace Direct_Verlet
 {
 
-void forward_init(const double *const ic, double *const state,
+//  pos and acc are work buffers of n bodies, kept between steps
+//  symmetric evaluates every pair once, see Direct_Kernel::accelerate_symmetric
+//  T = float selects the mixed precision kernel, which has no symmetric variant
+//  called by every thread of a parallel region, the phases are separated by the implicit barriers
+template <bool symmetric = false, typename T>
+void forward_init(const double *const ic, double *const state, Direct_Kernel::Basic_Soa<T> &pos, Direct_Kernel::Soa &acc,
                   const size_t n, const double dt, const double eps2) noexcept
 {
-    for (size_t i = 0; i < 3 * n; i++)
-        state[i] = 0;
+    pos.gather(ic);
+    static_assert(!symmetric || std::is_same_v<T, double>);
+    if constexpr (symmetric)
+        Direct_Kernel::accelerate_symmetric(pos, acc, eps2);
+    else
+        Direct_Kernel::accelerate(pos, acc, eps2);
 
-    memcpy(state + 3 * n, ic, 3 * n * sizeof(double));
-
-    #pragma omp parallel for default(none) shared(n, state, ic, eps2, dt)
+    #pragma omp for
     for (size_t i = 0; i < n; i++)
-    {   for (size_t j = 0; j < n; j++)
-            if (i != j)
-            {   const double b1 = state[3*(i+n)  ] - state[3*(j+n)  ];
-                const double b2 = state[3*(i+n)+1] - state[3*(j+n)+1];
-                const double b3 = state[3*(i+n)+2] - state[3*(j+n)+2];
-                double c = 1 / sqrt(b1 * b1 +
-                                    b2 * b2 +
-                                    b3 * b3 + eps2);
-                c = c * c * c;
-                state[3*i  ] -= c * b1;
-                state[3*i+1] -= c * b2;
-                state[3*i+2] -= c * b3;
-            }
-        state[3*i  ] = state[3*(i+n)  ] + (.5 * dt * state[3*i  ] + ic[3*(i+n)  ]) * dt;
-        state[3*i+1] = state[3*(i+n)+1] + (.5 * dt * state[3*i+1] + ic[3*(i+n)+1]) * dt;
-        state[3*i+2] = state[3*(i+n)+2] + (.5 * dt * state[3*i+2] + ic[3*(i+n)+2]) * dt;
+    {   state[3*(i+n)  ] = ic[3*i  ];
+        state[3*(i+n)+1] = ic[3*i+1];
+        state[3*(i+n)+2] = ic[3*i+2];
+        state[3*i  ] = state[3*(i+n)  ] + (.5 * dt * acc.x[i] + ic[3*(i+n)  ]) * dt;
+        state[3*i+1] = state[3*(i+n)+1] + (.5 * dt * acc.y[i] + ic[3*(i+n)+1]) * dt;
+        state[3*i+2] = state[3*(i+n)+2] + (.5 * dt * acc.z[i] + ic[3*(i+n)+2]) * dt;
     }
 }
 
 
 
-void forward(double *const state,
+template <bool symmetric = false, typename T>
+void forward(double *const state, Direct_Kernel::Basic_Soa<T> &pos, Direct_Kernel::Soa &acc,
              const size_t n, const double dt, const double eps2) noexcept
 {
-    #pragma omp parallel for default(none) shared(n, state, eps2, dt)
+    pos.gather(state);
+    static_assert(!symmetric || std::is_same_v<T, double>);
+    if constexpr (symmetric)
+        Direct_Kernel::accelerate_symmetric(pos, acc, eps2);
+    else
+        Direct_Kernel::accelerate(pos, acc, eps2);
+
+    #pragma omp for
     for (size_t i = 0; i < n; i++)
-    {   double a1 = 0;
-        double a2 = 0;
-        double a3 = 0;
-        for (size_t j = 0; j < n; j++)
-            if (i != j)
-            {   const double b1 = state[3*i  ] - state[3*j  ];
-                const double b2 = state[3*i+1] - state[3*j+1];
-                const double b3 = state[3*i+2] - state[3*j+2];
-                double c = 1 / sqrt(b1 * b1 +
-                                    b2 * b2 +
-                                    b3 * b3 + eps2);
-                c = c * c * c;
-                a1 -= c * b1;
-                a2 -= c * b2;
-                a3 -= c * b3;
-            }
-        const double d1 = state[3*(i+n)  ];
+    {   const double d1 = state[3*(i+n)  ];
         const double d2 = state[3*(i+n)+1];
         const double d3 = state[3*(i+n)+2];
         state[3*(i+n)  ] = state[3*i  ];
         state[3*(i+n)+1] = state[3*i+1];
         state[3*(i+n)+2] = state[3*i+2];
-        state[3*i  ] += state[3*i  ] - d1 + a1 * (dt * dt);
-        state[3*i+1] += state[3*i+1] - d2 + a2 * (dt * dt);
-        state[3*i+2] += state[3*i+2] - d3 + a3 * (dt * dt);
+        state[3*i  ] += state[3*i  ] - d1 + acc.x[i] * (dt * dt);
+        state[3*i+1] += state[3*i+1] - d2 + acc.y[i] * (dt * dt);
+        state[3*i+2] += state[3*i+2] - d3 + acc.z[i] * (dt * dt);
+    }
+}
+
+//  velocities at the positions of state, after forward or forward_init, which leave the previous positions and
+//  the acceleration there: the difference is the velocity half a step back, half a kick brings it to O(dt^2)
+void velocities(const double *const state, const Direct_Kernel::Soa &acc, double *const vel,
+                const size_t n, const double dt) noexcept
+{
+    #pragma omp for
+    for (size_t i = 0; i < n; i++)
+    {   vel[3*i  ] = (state[3*i  ] - state[3*(i+n)  ]) / dt + .5 * dt * acc.x[i];
+        vel[3*i+1] = (state[3*i+1] - state[3*(i+n)+1]) / dt + .5 * dt * acc.y[i];
+        vel[3*i+2] = (state[3*i+2] - state[3*(i+n)+2]) / dt + .5 * dt * acc.z[i];
     }
 }
 
@@ -26,11 +26,74 @@
 #include "field_vti.hh"
 #include "n_body_vtu.hh"
 #include "n_body_h5.hh"
+#include "async_writer.hh"
+#include "checkpoint.hh"
 #include <random>
 #include <array>
 
 #include <iostream>
 
+// the whole run on the 2D or 3D grid of the ic "0", e.g. python field_cosmological.py 3 256 -2 store 0 for 3D
+template <size_t order>
+void run()
+{
+    double rho_mean = 1e-4;
+    double dt = 1e-3;
+    double G = 1;
+    size_t N = 100;
+    size_t n = 10;
+    unsigned rigor = FFTW_MEASURE; // or FFTW_PATIENT, only costs time once thanks to the wisdom file
+    Storage::Checkpoint checkpoint {"0_field_periodic", 1800}; // every half hour
+
+    Storage::Field_vti<16, order> storage {"0"};
+    std::array<int, order> res = storage.resolution();
+    Field_Periodic::Fields<order> fields {res};
+
+    // plan before filling, since measuring overwrites the buffers
+    Field_Periodic::Plans<order> plans {fields, rigor};
+
+    // the state is in frequency space, so that is what a checkpoint holds, with the storage cursor
+    size_t cursor = 0;
+    uint64_t s_0 = 0;
+    auto blocks = [&]() -> std::vector<Storage::Checkpoint::Block>
+    {   return {Storage::Checkpoint::block(fields.rho_k, fields.size_k),
+                Storage::Checkpoint::block(fields.vel_k, order * fields.dist_k),
+                Storage::Checkpoint::block(&cursor)};
+    };
+    if (checkpoint.load(s_0, blocks()))
+        storage.resume(fields.rho, fields.vel, cursor);
+    else
+    {   storage.read(fields.rho, fields.vel); // this also sets the buffers it will write from
+        Field_Periodic::init_rho(fields, rho_mean);
+        Field_Periodic::init(plans);
+    }
+
+    // snapshots are written on a background thread, prep_for_store fills a free slot directly
+    Storage::Async_Writer<> writer {(1 + order) * fields.size, [&](double *const snapshot, const double t)
+    {   storage.set_buffers(snapshot, snapshot + fields.size);
+        storage.write(t);
+    }};
+
+    for (size_t s = s_0 + 1; s <= N; s++)
+    {   printf("{%zu}/{%zu}\n", s, N);
+        Field_Periodic::forward(fields, plans, G, dt);
+        if (s % n == 0)
+        {   double *snapshot = writer.acquire();
+            Field_Periodic::prep_for_store(fields, plans, rho_mean, snapshot, snapshot + fields.size);
+            writer.submit(s * dt);
+            if (checkpoint.due(s))
+            {   writer.flush();
+                cursor = storage.cursor();
+                checkpoint.save(s, blocks());
+            }
+        }
+    }
+
+    // the run completed, its checkpoint is dropped once the last snapshots are written
+    writer.flush();
+    checkpoint.remove();
+}
+
 int main()
 {
     // {
@@ -50,48 +113,9 @@ int main()
     //     }
     // }
 
-    double rho_mean = 1e-4;
-    double dt = 1e-3;
-    double G = 1;
-    size_t N = 100;
-    size_t n = 10;
-
-    Storage::Field_vti<16, 2> storage {"0"};
-    std::array<int, 2> res = storage.resolution();
-    size_t size = res[0] * res[1];
-
-    auto *data = new fftw_complex[size * (1 + 2 + 1 + 2)];
-    for (size_t i = 0; i < size * (1 + 2 + 1 + 2); i++)
-    {   data[i][0] = 0;
-        data[i][1] = 0;
-    }
-
-    storage.read(static_cast<double *>(*(data + 3 * size)),
-                 static_cast<double *>(*(data + 4 * size))); // this also sets the buffer to where it will write from
-    {   fftw_complex *rho = data + 3 * size;
-        fftw_complex *vel = data + 4 * size;
-        double *rho_ = static_cast<double *>(*rho);
-        double *vel_ = static_cast<double *>(*vel);
-        for (size_t i = size - 1; i != 0; i--)
-            rho[i][0] = rho_[i];
-        rho[0][0] = rho_[0];
-        for (size_t i = 2 * size - 1; i != 0; i--)
-            vel[i][0] = vel_[i];
-        vel[0][0] = vel_[0];
-    }
-
-    Field_Periodic::init_rho(data, res, size, rho_mean);
-    Field_Periodic::init(data, res, size);
-    // since initial velocity was set to 0, its FT might be bad, although it seems fine in numpy's FFT
-
-    for (size_t s = 1; s <= N; s++)
-    {   printf("{%zu}/{%zu}\n", s, N);
-        Field_Periodic::forward(data, res, size, G, dt);
-        if (s % n == 0)
-        {   Field_Periodic::prep_for_store(data, res, size, rho_mean);
-            storage.write(s * dt);
-        }
-    }
-
-    delete[] data;
+    // the dimension follows the ic
+    if (Storage::field_vti_order("0") == 3)
+        run<3>();
+    else
+        run<2>();
 }
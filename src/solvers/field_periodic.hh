@@ -25,131 +25,312 @@
 #pragma once
 
 #include <fftw3.h>
+#include <omp.h>
 #include <cmath>
 #include <array>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
 
 namespace Field_Periodic
 {
-    // rho is in contrast format rn in data[3:4], turn it into absolute rho in data[3:4]
-    void init_rho(fftw_complex *data, std::array<int, 2> res, size_t size, double rho_mean) noexcept
+    // frequency in cycles per cell of index i along a dimension of n cells, optionally 0 for the Nyquist mode
+    double frequency(int i, int n, bool drop_nyquist = false) noexcept
     {
-        fftw_complex *rho = data + 3 * size;
-        for (size_t i = 0; i < size; i++)
-            rho[i][0] = rho_mean * (1 + rho[i][0]);
+        if (drop_nyquist && 2 * i == n)
+            return 0;
+        return static_cast<double>(i <= n / 2 ? i : i - n) / n;
     }
 
-    // turn rho in data[3:4] and vel in data[4:6] in their FT and store in data[0:1] and data[1:3]
-    void init(fftw_complex *data, std::array<int, 2> res, size_t size) noexcept
+    // calls f(p, k, d) for every coefficient p of a half spectrum, with k its wavevector, and d that
+    // of derivatives, where Nyquist modes are dropped since they would break the Hermitian symmetry
+    template <size_t order, typename F>
+    void for_each_k(const std::array<int, order> &res, F &&f) noexcept
     {
-        fftw_plan plan_1 = fftw_plan_dft_2d(res[0], res[1], data + 3 * size, data           , FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_plan plan_2 = fftw_plan_dft_2d(res[0], res[1], data + 4 * size, data + 1 * size, FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_plan plan_3 = fftw_plan_dft_2d(res[0], res[1], data + 5 * size, data + 2 * size, FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_execute(plan_1);
-        fftw_execute(plan_2);
-        fftw_execute(plan_3);
-        fftw_destroy_plan(plan_1);
-        fftw_destroy_plan(plan_2);
-        fftw_destroy_plan(plan_3);
+        const int half = res[0] / 2 + 1;
+        const int n_z = order == 3 ? res[order - 1] : 1;
+        for (int l = 0; l < n_z; l++)
+            for (int i = 0; i < res[1]; i++)
+                for (int j = 0; j < half; j++)
+                {   double k[order];
+                    double d[order];
+                    k[0] = frequency(j, res[0]);
+                    d[0] = frequency(j, res[0], true);
+                    k[1] = frequency(i, res[1]);
+                    d[1] = frequency(i, res[1], true);
+                    if constexpr (order == 3)
+                    {   k[2] = frequency(l, res[2]);
+                        d[2] = frequency(l, res[2], true);
+                    }
+                    f((static_cast<size_t>(l) * res[1] + i) * half + j, k, d);
+                }
     }
 
-    // at this point rho and vel in freq space are set in data[0:1] and data[1:3],
-    // and we calculate their inverse FTs and store them in data[3:4] and data[4:6].
-    // do complex to real so that it stores right.
-    // also the density must become a density perturbation again
-    void prep_for_store(fftw_complex *data, std::array<int, 2> res, size_t size, double rho_mean) noexcept
+    // one fftw_malloc'd block for all buffers of a solver, handed out as views that each start on a page,
+    // so every view is aligned for the SIMD codelets of FFTW and for vectorized loops
+    class Arena
     {
-        fftw_plan plan_1 = fftw_plan_dft_2d(res[0], res[1], data,            data + 3 * size, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_plan plan_2 = fftw_plan_dft_2d(res[0], res[1], data + 1 * size, data + 4 * size, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_plan plan_3 = fftw_plan_dft_2d(res[0], res[1], data + 2 * size, data + 5 * size, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_execute(plan_1);
-        fftw_execute(plan_2);
-        fftw_execute(plan_3);
-        fftw_destroy_plan(plan_1);
-        fftw_destroy_plan(plan_2);
-        fftw_destroy_plan(plan_3);
-
-        fftw_complex *rho = data + 3 * size;
-        fftw_complex *vel = data + 4 * size;
-        double *rho_ = static_cast<double *>(*rho);
-        double *vel_ = static_cast<double *>(*vel);
-        for (size_t i = 0; i < size; i++)
-            rho_[i] = sqrt(rho[i][0] * rho[i][0] + rho[i][1] * rho[i][1]);
-        for (size_t i = 0; i < 2 * size; i++)
-            vel_[i] = sqrt(vel[i][0] * vel[i][0] + vel[i][1] * vel[i][1]);
-
-        for (size_t i = 0; i < size; i++)
-            rho_[i] = rho_[i] / rho_mean - 1;
+        static constexpr size_t page = 4096;
+        void *block;
+        char *next;
+
+    public:
+        static size_t pages(size_t bytes) noexcept
+        {   return (bytes + page - 1) / page * page;
+        }
+
+        explicit Arena(size_t bytes)
+        {   block = fftw_malloc(bytes + page);
+            next = reinterpret_cast<char *>(pages(reinterpret_cast<uintptr_t>(block)));
+        }
+
+        ~Arena()
+        {   fftw_free(block);
+        }
+
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        // the next n elements, the total of all views may not exceed the bytes the arena was made with
+        template <typename T>
+        T *view(size_t n) noexcept
+        {   T *v = reinterpret_cast<T *>(next);
+            next += pages(n * sizeof(T));
+            return v;
+        }
+    };
+
+    // real fields on a 2D or 3D grid of res cells, x fastest as in Field_vti, with the velocity interleaved per cell.
+    // the state is kept in frequency space as half spectra: real to complex transforms only keep the
+    // res[0] / 2 + 1 non negative x frequencies, the others follow from Hermitian symmetry.
+    // all spectra are unnormalized FFTs of the physical fields.
+    // during a step all real fields live in work, transformed in place, so rho and vel are only used for storage.
+    // in work, real field c is at work + 2 dist_k c, with rows padded to 2 (res[0] / 2 + 1).
+    // components are dist_k apart, size_k rounded up to 64 bytes, so that every transform of a batch is aligned.
+    template <size_t order, typename = std::enable_if_t<order == 2 || order == 3>>
+    struct Fields
+    {
+        std::array<int, order> res;
+        size_t size;            // # cells
+        size_t size_k;          // # complex coefficients per field
+        size_t dist_k;          // distance between components in complex coefficients
+        Arena arena;
+        double *rho;            // real space density, storage reads into and writes from here
+        double *vel;            // real space velocity
+        fftw_complex *rho_k;
+        fftw_complex *vel_k;    // components one after the other
+        fftw_complex *work_k;   // rho and vel spectra, destroyed by the in place complex to real transform, then the flux
+        double *work;           // work_k as padded real fields, rho and vel, then rho vel
+        double *green;          // 2 / k^2 per coefficient, 0 for the mean, so the acceleration is i G k green rho_k
+        double *deriv;          // derivative frequencies per coefficient, components one after the other
+
+        static size_t cells(const std::array<int, order> &res, bool half) noexcept
+        {   size_t n = half ? res[0] / 2 + 1 : res[0];
+            for (size_t d = 1; d < order; d++)
+                n *= res[d];
+            return n;
+        }
+
+        // bytes of all views, in the order they are taken
+        size_t bytes() const noexcept
+        {   return Arena::pages(size * sizeof(double))
+                 + Arena::pages(order * size * sizeof(double))
+                 + Arena::pages(size_k * sizeof(fftw_complex))
+                 + Arena::pages(order * dist_k * sizeof(fftw_complex))
+                 + Arena::pages((1 + order) * dist_k * sizeof(fftw_complex))
+                 + Arena::pages(size_k * sizeof(double))
+                 + Arena::pages(order * dist_k * sizeof(double));
+        }
+
+        explicit Fields(std::array<int, order> res)
+            : res {res}, size {cells(res, false)}, size_k {cells(res, true)}, dist_k {(size_k + 3) / 4 * 4},
+              arena {bytes()}
+        {   rho    = arena.view<double>(size);
+            vel    = arena.view<double>(order * size);
+            rho_k  = arena.view<fftw_complex>(size_k);
+            vel_k  = arena.view<fftw_complex>(order * dist_k);
+            work_k = arena.view<fftw_complex>((1 + order) * dist_k);
+            work   = reinterpret_cast<double *>(work_k);
+            green  = arena.view<double>(size_k);
+            deriv  = arena.view<double>(order * dist_k);
+            init_tables();
+        }
+
+        Fields(const Fields &) = delete;
+        Fields &operator=(const Fields &) = delete;
+
+        // the wavevector dependent factors of the spectral updates, which only depend on res
+        void init_tables() noexcept
+        {   for_each_k<order>(res, [&](size_t p, const double *k, const double *d)
+            {   double k2 = 0;
+                for (size_t c = 0; c < order; c++)
+                {   k2 += k[c] * k[c];
+                    deriv[c*dist_k+p] = d[c];
+                }
+                green[p] = k2 == 0 ? 0 : 2 / k2; // the mean density exerts no force
+            });
+        }
+
+        // FFTW dimensions, slowest first
+        std::array<int, order> fft_dims() const noexcept
+        {   std::array<int, order> n;
+            for (size_t d = 0; d < order; d++)
+                n[d] = res[order - 1 - d];
+            return n;
+        }
+    };
+
+    // all transforms of the solver, planned once for the fields and kept for the whole run.
+    // planning with FFTW_MEASURE or FFTW_PATIENT overwrites the fields, so make the plans before filling them.
+    // wisdom is loaded from and saved to a file, so that later runs with the same resolution plan instantly.
+    // the transforms use all OpenMP threads. all components go in one plan (strided or batched).
+    // the grid lives in the memory of one node, the transforms are not distributed.
+    template <size_t order>
+    struct Plans
+    {
+        fftw_plan rho_forward;      // rho -> rho_k
+        fftw_plan vel_forward;      // vel -> vel_k
+        fftw_plan backward;         // work_k -> work, in place
+        fftw_plan flux_forward;     // work + 2 dist_k -> work_k + dist_k, in place
+
+        Plans(Fields<order> &f, unsigned flags = FFTW_MEASURE, const char *wisdom = "field_periodic.wisdom")
+        {   fftw_init_threads();
+            fftw_plan_with_nthreads(omp_get_max_threads());
+            fftw_import_wisdom_from_filename(wisdom);
+            const std::array<int, order> n = f.fft_dims();
+            std::array<int, order> padded = n;
+            padded[order - 1] = 2 * (n[order - 1] / 2 + 1);
+            const int dist_k = static_cast<int>(f.dist_k);
+            rho_forward  = fftw_plan_dft_r2c(order, n.data(), f.rho, f.rho_k, flags);
+            vel_forward  = fftw_plan_many_dft_r2c(order, n.data(), order, f.vel, nullptr, order, 1,
+                                                  f.vel_k, nullptr, 1, dist_k, flags);
+            backward     = fftw_plan_many_dft_c2r(order, n.data(), 1 + order, f.work_k, nullptr, 1, dist_k,
+                                                  f.work, padded.data(), 1, 2 * dist_k, flags);
+            flux_forward = fftw_plan_many_dft_r2c(order, n.data(), order, f.work + 2 * dist_k, padded.data(), 1, 2 * dist_k,
+                                                  f.work_k + dist_k, nullptr, 1, dist_k, flags);
+            fftw_export_wisdom_to_filename(wisdom);
+        }
+
+        ~Plans()
+        {   fftw_destroy_plan(rho_forward);
+            fftw_destroy_plan(vel_forward);
+            fftw_destroy_plan(backward);
+            fftw_destroy_plan(flux_forward);
+        }
+
+        Plans(const Plans &) = delete;
+        Plans &operator=(const Plans &) = delete;
+    };
+
+    // rho is in contrast format, turn it into absolute rho
+    template <size_t order>
+    void init_rho(Fields<order> &f, double rho_mean) noexcept
+    {
+        #pragma omp parallel for simd
+        for (size_t i = 0; i < f.size; i++)
+            f.rho[i] = rho_mean * (1 + f.rho[i]);
+    }
+
+    // rho and vel to frequency space, the real to complex transforms keep their input
+    template <size_t order>
+    void init(const Plans<order> &plans) noexcept
+    {
+        fftw_execute(plans.rho_forward);
+        fftw_execute(plans.vel_forward);
     }
 
-    void forward(fftw_complex *data, std::array<int, 2> res, size_t size, double G, double dt) noexcept
+    // rho and vel back to real space in work, multiplied by size, the spectra are kept
+    template <size_t order>
+    void to_real(Fields<order> &f, const Plans<order> &plans) noexcept
     {
-        // update vel in data[1:3]
-        //     multiplying by i means what? (a+bi)i = -b+ai, so 
-        //     for adding to our real part, look at negatige imaginary part, and
+        memcpy(f.work_k, f.rho_k, f.size_k * sizeof(fftw_complex));
+        memcpy(f.work_k + f.dist_k, f.vel_k, order * f.dist_k * sizeof(fftw_complex));
+        fftw_execute(plans.backward);
+    }
+
+    // real space rho and vel for storing into the given buffers, the density as a density perturbation again
+    template <size_t order>
+    void prep_for_store(Fields<order> &f, const Plans<order> &plans, double rho_mean, double *rho, double *vel) noexcept
+    {
+        to_real(f, plans);
+        const size_t n_x = f.res[0];
+        const size_t row = 2 * (n_x / 2 + 1);
+        const size_t rows = f.size / n_x;
+        const size_t dist = 2 * f.dist_k;
+        const double norm = 1. / f.size;
+        #pragma omp parallel for
+        for (size_t r = 0; r < rows; r++)
+            for (size_t x = 0; x < n_x; x++)
+            {   const size_t i = r * n_x + x;
+                const size_t q = r * row + x;
+                rho[i] = f.work[q] * norm / rho_mean - 1;
+                for (size_t c = 0; c < order; c++)
+                    vel[order*i+c] = f.work[(1+c)*dist+q] * norm;
+            }
+    }
+
+    // same, into rho and vel of the fields
+    template <size_t order>
+    void prep_for_store(Fields<order> &f, const Plans<order> &plans, double rho_mean) noexcept
+    {
+        prep_for_store(f, plans, rho_mean, f.rho, f.vel);
+    }
+
+    template <size_t order>
+    void forward(Fields<order> &f, const Plans<order> &plans, double G, double dt) noexcept
+    {
+        // update vel_k with the gravitational acceleration i 2 G k rho_k / k^2
+        //     multiplying by i means what? (a+bi)i = -b+ai, so
+        //     for adding to our real part, look at negative imaginary part, and
         //     for adding to our imaginary part, look at real part
-        fftw_complex *rho = data;
-        fftw_complex *vel_x = data + 1 * size;
-        fftw_complex *vel_y = data + 2 * size;
-        for (size_t i = 0; i < res[0]; i++)
-            for (size_t j = 0; j < res[1]; j++)
-            {   // we interpret the space step to be 1. here we calculate what
-                // the frequency should be under that assumption, as returned by FFT.
-                double k_x = j <= .5 * res[0] ? static_cast<double>(j) / res[0] : static_cast<double>(j - res[0]) / res[0];
-                double k_y = i <= .5 * res[1] ? static_cast<double>(i) / res[1] : static_cast<double>(i - res[1]) / res[1];
-                double k = sqrt(k_x * k_x + k_y * k_y);
-                if (k == 0) // dumb temp fix for when k = 0, idrk what do about this
-                    k = 1;
-                size_t p = i*res[0]+j;
-                vel_x[p][0] += dt * 2 * (-rho[p][1]) * G * k_x / (k * k);
-                vel_x[p][1] += dt * 2 * ( rho[p][0]) * G * k_x / (k * k);
-                vel_y[p][0] += dt * 2 * (-rho[p][1]) * G * k_y / (k * k);
-                vel_y[p][1] += dt * 2 * ( rho[p][0]) * G * k_y / (k * k);
+        //     we interpret the space step to be 1, so frequencies are in cycles per cell
+        fftw_complex *rho = f.rho_k;
+        fftw_complex *vel = f.vel_k;
+        const double *green = f.green;
+        const double *deriv = f.deriv;
+        const size_t size_k = f.size_k;
+        const size_t dist_k = f.dist_k;
+        const double a = dt * G;
+        #pragma omp parallel for simd
+        for (size_t p = 0; p < size_k; p++)
+        {   const double re = -rho[p][1] * a * green[p];
+            const double im =  rho[p][0] * a * green[p];
+            for (size_t c = 0; c < order; c++)
+            {   vel[c*dist_k+p][0] += re * deriv[c*dist_k+p];
+                vel[c*dist_k+p][1] += im * deriv[c*dist_k+p];
             }
+        }
 
-        // inverse FT of rho in freq in data[0:1], into data[3:4]
-        // 2 inverse FTs of vel in freq in data[1:3], goes into data[4:6]
-        fftw_plan plan_1 = fftw_plan_dft_2d(res[0], res[1], data,            data + 3 * size, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_plan plan_2 = fftw_plan_dft_2d(res[0], res[1], data + 1 * size, data + 4 * size, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_plan plan_3 = fftw_plan_dft_2d(res[0], res[1], data + 2 * size, data + 5 * size, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_execute(plan_1);
-        fftw_execute(plan_2);
-        fftw_execute(plan_3);
-        fftw_destroy_plan(plan_1);
-        fftw_destroy_plan(plan_2);
-        fftw_destroy_plan(plan_3);
-        // evaluate product of above 2 and put in data[4:6]
-        //     an FFT returns frequencies multiplied by size. this isn't a problem anywhere because
-        //     we stay in freq space anyway and don't use freq data directly, but since we calculate
-        //     product of two FFTs we'll have multiplied twice by size, so need to divide this product
-        //     by size after.
-        rho = data + 3 * size;
-        vel_x = data + 4 * size;
-        vel_y = data + 5 * size;
-        for (size_t i = 0; i < size; i++)
-        {   // (a+bi)(c+di) = (ac-bd)+(ad+bc)i
-            vel_x[i][0] = rho[i][0] * vel_x[i][0] - rho[i][1] * vel_x[i][1];
-            vel_y[i][0] = rho[i][0] * vel_y[i][0] - rho[i][1] * vel_y[i][1];
-            vel_x[i][0] /= size;
-            vel_y[i][0] /= size;
+        // rho vel in real space, in place of vel in work, then its FT in work_k[1:]
+        //     both real fields are multiplied by size, so the product needs dividing by size^2
+        //     to be consistent with the unnormalized spectra
+        //     the row padding is multiplied along, the real to complex transform ignores it
+        to_real(f, plans);
+        const double *rho_x = f.work;
+        double *rho_vel = f.work + 2 * dist_k;
+        const size_t n_real = 2 * size_k;
+        const double norm = 1. / (static_cast<double>(f.size) * f.size);
+        for (size_t c = 0; c < order; c++)
+        {
+            #pragma omp parallel for simd
+            for (size_t q = 0; q < n_real; q++)
+                rho_vel[2*c*dist_k+q] *= rho_x[q] * norm;
         }
-        // 2 FTs of that product in data[4:6] in place
-        fftw_plan plan_4 = fftw_plan_dft_2d(res[0], res[1], data + 4 * size, data + 4 * size, FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_plan plan_5 = fftw_plan_dft_2d(res[0], res[1], data + 5 * size, data + 5 * size, FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_execute(plan_4);
-        fftw_execute(plan_5);
-        fftw_destroy_plan(plan_4);
-        fftw_destroy_plan(plan_5);
-        // update rho in data[0:1]
-        rho = data;
-        vel_x = data + 1 * size;
-        vel_y = data + 2 * size;
-        for (size_t i = 0; i < res[0]; i++)
-            for (size_t j = 0; j < res[1]; j++)
-            {   double k_x = j <= .5 * res[0] ? static_cast<double>(j) / res[0] : static_cast<double>(j - res[0]) / res[0];
-                double k_y = i <= .5 * res[1] ? static_cast<double>(i) / res[1] : static_cast<double>(i - res[1]) / res[1];
-                size_t p = i*res[0]+j;
-                rho[p][0] += -dt * 2 * M_PI * (-vel_x[p][1] * k_x - vel_y[p][1] * k_y);
-                rho[p][1] += -dt * 2 * M_PI * ( vel_x[p][0] * k_x + vel_y[p][0] * k_y);
+        fftw_execute(plans.flux_forward);
+
+        // update rho_k by the divergence of the flux, -i 2 pi k . flux_k
+        const fftw_complex *flux = f.work_k + dist_k;
+        const double b = -dt * 2 * M_PI;
+        #pragma omp parallel for simd
+        for (size_t p = 0; p < size_k; p++)
+        {   double re = 0;
+            double im = 0;
+            for (size_t c = 0; c < order; c++)
+            {   re += -flux[c*dist_k+p][1] * deriv[c*dist_k+p];
+                im +=  flux[c*dist_k+p][0] * deriv[c*dist_k+p];
             }
+            rho[p][0] += b * re;
+            rho[p][1] += b * im;
+        }
     }
 }
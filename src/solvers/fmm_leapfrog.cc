@@ -0,0 +1,122 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fmm_leapfrog.hh"
+#include "n_body_h5.hh"
+#include "n_body_vtu.hh"
+#include "async_writer.hh"
+#include "checkpoint.hh"
+#include "series_h5.hh"
+#include "diagnostics.hh"
+#include <cstdio>
+#include <cstring>
+#include <optional>
+
+int main()
+{
+    /* number of time steps  */ constexpr size_t n_t = 10000000;
+    /* steps between process */ constexpr size_t n_s = 2000;
+    /* time step             */ constexpr double dt   = 1e-6;
+    /* softening eps^2       */ constexpr double eps2 = 3e-5;
+    /* well-separated ratio  */ constexpr double theta = .5;
+    /* expansion order       */ constexpr size_t p = 4;
+    /* h5 file with ic       */ Storage::N_Body_vtu<10000> storage {"king"};
+                                size_t n = storage.n_objects();
+    /* integrator memory     */ auto *state = new double[6 * n];
+                                auto *acc   = new double[3 * n];
+                                Octree<16> tree;
+                                Fmm_Leapfrog::Fmm<p> fmm;
+    /* store vel also?       */ constexpr bool store_velocities = true;
+    /* diagnostics memory    */ Diagnostics::Buffers diagnostics {n};
+                                Diagnostics::Record record;
+                                std::optional<Storage::Series_h5> series;
+    /* checkpoint every (s)  */ Storage::Checkpoint checkpoint {"king_fmm_leapfrog", 1800};
+
+    //  read ic, pos and vel, or resume from the last checkpoint, which has the state and the cursors of the
+    //  storage and of the diagnostics series
+    size_t cursor = 0;
+    Storage::Series_h5::Cursor series_cursor {};
+    uint64_t s_0 = 0;
+    const bool resumed = checkpoint.load(s_0, {Storage::Checkpoint::block(state, 6 * n),
+                                               Storage::Checkpoint::block(&cursor),
+                                               Storage::Checkpoint::block(&series_cursor)});
+    if (resumed)
+    {   storage.resume(state, state + 3 * n, cursor);
+        series.emplace("king_fmm_leapfrog_diagnostics", "diagnostics", Diagnostics::n_columns, series_cursor);
+    }
+    else
+    {   storage.read(state, state + 3 * n);
+        series.emplace("king_fmm_leapfrog_diagnostics", "diagnostics", Diagnostics::names, Diagnostics::n_columns);
+    }
+
+    //  vel buffer was set by 'read', so need explicit 'no_vel' to not update
+    if constexpr (!store_velocities)
+        storage.no_vel();
+
+    //  snapshots are written on a background thread, from copies of the state,
+    //  each followed by its row of diagnostics, which go to the series
+    const size_t snapshot_size = (store_velocities ? 6 : 3) * n;
+    Storage::Async_Writer<> writer {snapshot_size + Diagnostics::n_columns, [&](double *const snapshot, const double t)
+    {   if constexpr (store_velocities)
+            storage.set_buffers(snapshot, snapshot + 3 * n);
+        else
+            storage.set_buffer(snapshot);
+        storage.write(t);
+        series->write(snapshot + snapshot_size);
+    }};
+
+    //  process state function, with the diagnostics, and checkpoint when due
+    auto process = [&](size_t s)
+    {
+        #pragma omp parallel
+        Diagnostics::measure(state, state + 3 * n, diagnostics, 1, 1, eps2, s * dt, record);
+        double *const snapshot = writer.acquire();
+        memcpy(snapshot, state, snapshot_size * sizeof(double));
+        memcpy(snapshot + snapshot_size, &record, sizeof(record));
+        writer.submit(s * dt);
+        printf("{%zu}/{%zu} energy %.15e\n", s, n_t, record.kinetic + record.potential);
+        if (checkpoint.due(s))
+        {   writer.flush();
+            cursor = storage.cursor();
+            series_cursor = series->cursor();
+            checkpoint.save(s, {Storage::Checkpoint::block(state, 6 * n),
+                                Storage::Checkpoint::block(&cursor),
+                                Storage::Checkpoint::block(&series_cursor)});
+        }
+    };
+
+    //  main loop
+    for (size_t s = s_0 + 1; s <= n_t; s++)
+    {   Fmm_Leapfrog::forward(tree, fmm, acc, state, n, dt, eps2, theta);
+        if (s % n_s == 0)
+            process(s);
+    }
+
+    //  the run completed, its checkpoint is dropped once the last snapshots are written
+    writer.flush();
+    checkpoint.remove();
+
+    delete[] acc;
+    delete[] state;
+}
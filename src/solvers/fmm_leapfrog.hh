@@ -0,0 +1,338 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "octree.hh"
+#include <cmath>
+#include <vector>
+
+namespace Fmm_Leapfrog
+{
+
+//  Cartesian fast multipole method of expansion order p on the octree of Tree_Leapfrog
+//  kernel is the softened 1 / sqrt(r^2 + eps^2), expanded as G(x - y) = sum_k a_k(x - c) (y - c)^k,
+//  where the Taylor coefficients a_k follow from the recurrence of Duan & Krasny (2001)
+//  multipoles and locals are stored as coefficients of monomials, multi-indices ordered by degree
+template <size_t p>
+struct Fmm
+{
+    static constexpr size_t n_coef = (p + 1) * (p + 2) * (p + 3) / 6;
+
+    struct Tables
+    {   size_t k[n_coef][3];            // multi-indices
+        size_t index[p+1][p+1][p+1];    // inverse of k
+        double binom[p+1][p+1];
+    };
+
+    static constexpr Tables make_tables() noexcept
+    {   Tables t {};
+        size_t c = 0;
+        for (size_t d = 0; d <= p; d++)
+            for (size_t k1 = d + 1; k1-- > 0;)
+                for (size_t k2 = d - k1 + 1; k2-- > 0;)
+                {   const size_t k3 = d - k1 - k2;
+                    t.k[c][0] = k1;
+                    t.k[c][1] = k2;
+                    t.k[c][2] = k3;
+                    t.index[k1][k2][k3] = c++;
+                }
+        for (size_t i = 0; i <= p; i++)
+        {   t.binom[i][0] = 1;
+            for (size_t j = 1; j <= i; j++)
+                t.binom[i][j] = t.binom[i-1][j-1] + (j < i ? t.binom[i-1][j] : 0);
+        }
+        return t;
+    }
+
+    static constexpr Tables tables = make_tables();
+
+    //  number of multi-indices up to degree d
+    static constexpr size_t n_up_to(const size_t d) noexcept
+    {   return (d + 1) * (d + 2) * (d + 3) / 6;
+    }
+
+    std::vector<double> multipoles;
+    std::vector<double> locals;
+    std::vector<double> radii;
+
+    static void powers(const double b1, const double b2, const double b3, double (&w)[3][p+1]) noexcept
+    {   w[0][0] = w[1][0] = w[2][0] = 1;
+        for (size_t i = 1; i <= p; i++)
+        {   w[0][i] = w[0][i-1] * b1;
+            w[1][i] = w[1][i-1] * b2;
+            w[2][i] = w[2][i-1] * b3;
+        }
+    }
+
+    static void taylor(const double z1, const double z2, const double z3, const double eps2, double *const a) noexcept
+    {   const double z[3] {z1, z2, z3};
+        const double r2 = 1 / (z1 * z1 + z2 * z2 + z3 * z3 + eps2);
+        a[0] = sqrt(r2);
+        for (size_t c = 1; c < n_coef; c++)
+        {   const size_t *k = tables.k[c];
+            const double d = static_cast<double>(k[0] + k[1] + k[2]);
+            double s1 = 0;
+            double s2 = 0;
+            for (size_t i = 0; i < 3; i++)
+            {   if (k[i] >= 1)
+                    s1 += z[i] * a[tables.index[k[0]-(i==0)][k[1]-(i==1)][k[2]-(i==2)]];
+                if (k[i] >= 2)
+                    s2 += a[tables.index[k[0]-2*(i==0)][k[1]-2*(i==1)][k[2]-2*(i==2)]];
+            }
+            a[c] = ((2 * d - 1) * s1 - (d - 1) * s2) * r2 / d;
+        }
+    }
+
+    //  P2M at leaves, M2M at internal nodes
+    template <size_t n_leaf, size_t n_task>
+    void upward(const Octree<n_leaf, n_task> &tree, const size_t index) noexcept
+    {   const auto &node = tree.nodes[index];
+        double *const m = multipoles.data() + index * n_coef;
+        for (size_t c = 0; c < n_coef; c++)
+            m[c] = 0;
+        radii[index] = 0;
+        if (node.mass == 0)
+            return;
+        if (node.child == 0)
+        {   double w[3][p+1];
+            for (size_t l = node.begin; l < node.end; l++)
+            {   const double b1 = tree.pos[3*l  ] - node.com[0];
+                const double b2 = tree.pos[3*l+1] - node.com[1];
+                const double b3 = tree.pos[3*l+2] - node.com[2];
+                radii[index] = std::max(radii[index], sqrt(b1 * b1 + b2 * b2 + b3 * b3));
+                powers(b1, b2, b3, w);
+                for (size_t c = 0; c < n_coef; c++)
+                    m[c] += w[0][tables.k[c][0]] * w[1][tables.k[c][1]] * w[2][tables.k[c][2]];
+            }
+            return;
+        }
+        for (size_t i = 0; i < 8; i++)
+            if (tree.nodes[node.child+i].end - tree.nodes[node.child+i].begin > n_task)
+            {
+                #pragma omp task default(shared) firstprivate(i)
+                upward(tree, node.child + i);
+            }
+            else
+                upward(tree, node.child + i);
+        #pragma omp taskwait
+        for (size_t i = 0; i < 8; i++)
+        {   const auto &child = tree.nodes[node.child+i];
+            if (child.mass == 0)
+                continue;
+            const double *const m_child = multipoles.data() + (node.child + i) * n_coef;
+            const double b1 = child.com[0] - node.com[0];
+            const double b2 = child.com[1] - node.com[1];
+            const double b3 = child.com[2] - node.com[2];
+            radii[index] = std::max(radii[index], radii[node.child+i] + sqrt(b1 * b1 + b2 * b2 + b3 * b3));
+            double w[3][p+1];
+            powers(b1, b2, b3, w);
+            for (size_t c = 0; c < n_coef; c++)
+            {   const size_t *k = tables.k[c];
+                for (size_t e = 0; e < n_up_to(k[0] + k[1] + k[2]); e++)
+                {   const size_t *l = tables.k[e];
+                    if (l[0] <= k[0] && l[1] <= k[1] && l[2] <= k[2])
+                        m[c] += tables.binom[k[0]][l[0]] * tables.binom[k[1]][l[1]] * tables.binom[k[2]][l[2]] *
+                                w[0][k[0]-l[0]] * w[1][k[1]-l[1]] * w[2][k[2]-l[2]] * m_child[e];
+                }
+            }
+        }
+    }
+
+    //  M2L from source node b into the local expansion of node a
+    template <size_t n_leaf, size_t n_task>
+    void m2l(const Octree<n_leaf, n_task> &tree, const size_t a, const size_t b, const double eps2) noexcept
+    {   const auto &target = tree.nodes[a];
+        const auto &source = tree.nodes[b];
+        double t[n_coef];
+        taylor(target.com[0] - source.com[0],
+               target.com[1] - source.com[1],
+               target.com[2] - source.com[2], eps2, t);
+        const double *const m = multipoles.data() + b * n_coef;
+        double *const l = locals.data() + a * n_coef;
+        for (size_t c = 0; c < n_coef; c++)
+        {   const size_t *n = tables.k[c];
+            const size_t d = n[0] + n[1] + n[2];
+            double sum = 0;
+            for (size_t e = 0; e < n_up_to(p - d); e++)
+            {   const size_t *k = tables.k[e];
+                sum += tables.binom[k[0]+n[0]][n[0]] * tables.binom[k[1]+n[1]][n[1]] * tables.binom[k[2]+n[2]][n[2]] *
+                       m[e] * t[tables.index[k[0]+n[0]][k[1]+n[1]][k[2]+n[2]]];
+            }
+            l[c] += d % 2 == 0 ? sum : -sum;
+        }
+    }
+
+    //  L2L from node a into its child
+    void l2l(const double *const l, double *const l_child, const double b1, const double b2, const double b3) noexcept
+    {   double w[3][p+1];
+        powers(b1, b2, b3, w);
+        for (size_t c = 0; c < n_coef; c++)
+        {   const size_t *m = tables.k[c];
+            double sum = 0;
+            for (size_t e = c; e < n_coef; e++)
+            {   const size_t *n = tables.k[e];
+                if (n[0] >= m[0] && n[1] >= m[1] && n[2] >= m[2])
+                    sum += tables.binom[n[0]][m[0]] * tables.binom[n[1]][m[1]] * tables.binom[n[2]][m[2]] *
+                           w[0][n[0]-m[0]] * w[1][n[1]-m[1]] * w[2][n[2]-m[2]] * l[e];
+            }
+            l_child[c] = sum;
+        }
+    }
+
+    //  interaction lists are passed down the target tree, so every task owns the locals and
+    //  accelerations of its own subtree and no synchronization is needed
+    template <size_t n_leaf, size_t n_task>
+    void downward(const Octree<n_leaf, n_task> &tree, double *const acc, const size_t a,
+                  std::vector<size_t> list, const double eps2, const double theta) noexcept
+    {   const auto &target = tree.nodes[a];
+        std::vector<size_t> kept;
+        while (!list.empty())
+        {   const size_t b = list.back();
+            list.pop_back();
+            const auto &source = tree.nodes[b];
+            if (source.mass == 0)
+                continue;
+            const double b1 = target.com[0] - source.com[0];
+            const double b2 = target.com[1] - source.com[1];
+            const double b3 = target.com[2] - source.com[2];
+            const double r = radii[a] + radii[b];
+            if (r * r < theta * theta * (b1 * b1 + b2 * b2 + b3 * b3))
+                m2l(tree, a, b, eps2);
+            else if (target.child == 0 && source.child == 0)
+            {   //  P2P, a body contributes nothing to itself since eps2 > 0
+                for (size_t k = target.begin; k < target.end; k++)
+                {   double a1 = 0;
+                    double a2 = 0;
+                    double a3 = 0;
+                    for (size_t l = source.begin; l < source.end; l++)
+                    {   const double d1 = tree.pos[3*k  ] - tree.pos[3*l  ];
+                        const double d2 = tree.pos[3*k+1] - tree.pos[3*l+1];
+                        const double d3 = tree.pos[3*k+2] - tree.pos[3*l+2];
+                        double c = 1 / sqrt(d1 * d1 +
+                                            d2 * d2 +
+                                            d3 * d3 + eps2);
+                        c = c * c * c;
+                        a1 -= c * d1;
+                        a2 -= c * d2;
+                        a3 -= c * d3;
+                    }
+                    acc[3*k  ] += a1;
+                    acc[3*k+1] += a2;
+                    acc[3*k+2] += a3;
+                }
+            }
+            else if (target.child == 0 || (source.child != 0 && radii[b] > radii[a]))
+                for (size_t i = 0; i < 8; i++)
+                    list.push_back(source.child + i);
+            else
+                kept.push_back(b);
+        }
+
+        const double *const l = locals.data() + a * n_coef;
+        if (target.child == 0)
+        {   //  L2P, acceleration is the gradient of sum_n L_n u^n
+            double w[3][p+1];
+            for (size_t k = target.begin; k < target.end; k++)
+            {   powers(tree.pos[3*k  ] - target.com[0],
+                       tree.pos[3*k+1] - target.com[1],
+                       tree.pos[3*k+2] - target.com[2], w);
+                double a1 = 0;
+                double a2 = 0;
+                double a3 = 0;
+                for (size_t c = 1; c < n_coef; c++)
+                {   const size_t *n = tables.k[c];
+                    if (n[0] >= 1)
+                        a1 += l[c] * n[0] * w[0][n[0]-1] * w[1][n[1]  ] * w[2][n[2]  ];
+                    if (n[1] >= 1)
+                        a2 += l[c] * n[1] * w[0][n[0]  ] * w[1][n[1]-1] * w[2][n[2]  ];
+                    if (n[2] >= 1)
+                        a3 += l[c] * n[2] * w[0][n[0]  ] * w[1][n[1]  ] * w[2][n[2]-1];
+                }
+                acc[3*k  ] += a1;
+                acc[3*k+1] += a2;
+                acc[3*k+2] += a3;
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < 8; i++)
+        {   const size_t child = target.child + i;
+            if (tree.nodes[child].mass == 0)
+                continue;
+            l2l(l, locals.data() + child * n_coef,
+                tree.nodes[child].com[0] - target.com[0],
+                tree.nodes[child].com[1] - target.com[1],
+                tree.nodes[child].com[2] - target.com[2]);
+            if (tree.nodes[child].end - tree.nodes[child].begin > n_task)
+            {
+                #pragma omp task default(shared) firstprivate(child, kept)
+                downward(tree, acc, child, kept, eps2, theta);
+            }
+            else
+                downward(tree, acc, child, kept, eps2, theta);
+        }
+        #pragma omp taskwait
+    }
+
+    //  acceleration of every body in Morton order
+    template <size_t n_leaf, size_t n_task>
+    void accelerate(const Octree<n_leaf, n_task> &tree, double *const acc, const size_t n,
+                    const double eps2, const double theta)
+    {   multipoles.resize(tree.n_nodes * n_coef);
+        locals.resize(tree.n_nodes * n_coef);
+        radii.resize(tree.n_nodes);
+        for (size_t i = 0; i < 3 * n; i++)
+            acc[i] = 0;
+        for (size_t c = 0; c < n_coef; c++)
+            locals[c] = 0;
+        #pragma omp parallel
+        #pragma omp single
+        {   upward(tree, 0);
+            downward(tree, acc, 0, {0}, eps2, theta);
+        }
+    }
+};
+
+//  same kick-drift step as Direct_Leapfrog, with FMM forces
+//  acc is a buffer of 3 * n, tree and fmm are kept between steps so their storage is reused
+template <size_t p, size_t n_leaf, size_t n_task>
+void forward(Octree<n_leaf, n_task> &tree, Fmm<p> &fmm, double *const acc, double *const state, const size_t n,
+             const double dt, const double eps2, const double theta)
+{
+    tree.build(state, n);
+    fmm.accelerate(tree, acc, n, eps2, theta);
+
+    #pragma omp parallel for default(none) shared(tree, acc, n, state, dt)
+    for (size_t k = 0; k < n; k++)
+    {   const size_t i = tree.keys[k].second;
+        state[3*(i+n)  ] += acc[3*k  ] * dt;
+        state[3*(i+n)+1] += acc[3*k+1] * dt;
+        state[3*(i+n)+2] += acc[3*k+2] * dt;
+        state[3*i  ] += state[3*(i+n)  ] * dt;
+        state[3*i+1] += state[3*(i+n)+1] * dt;
+        state[3*i+2] += state[3*(i+n)+2] * dt;
+    }
+}
+
+};
@@ -0,0 +1,115 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "mesh_leapfrog.hh"
+#include "n_body_h5.hh"
+#include "n_body_raw.hh"
+#include "async_writer.hh"
+#include "checkpoint.hh"
+#include <cstdio>
+#include <optional>
+
+int main()
+{
+    /* number of time steps  */ constexpr size_t n_t = 10000;
+    /* steps between process */ constexpr size_t n_s = 10;
+    /* time step             */ constexpr double dt   = 1e-3;
+    /* gravitational const   */ constexpr double G    = 1;
+    /* periodic box size     */ constexpr double box  = 1;
+    /* mesh resolution       */ constexpr int    res  = 256;
+    /* h5 file with ic       */ Storage::N_Body_h5 storage {"cosmological"};
+                                size_t n = storage.n_objects();
+    /* particle mass         */ const double mass = 1. / n;
+    /* integrator memory     */ auto *state = new double[6 * n];
+                                auto *acc   = new double[3 * n];
+    /* mass assignment, TSC  */ Mesh_Leapfrog::Mesh<2> mesh {{res, res, res}, box, G, mass};
+    /* store vel also?       */ constexpr bool store_velocities = false;
+    /* flat mapped output?   */ constexpr bool raw = true;
+                                std::optional<Storage::N_Body_Raw> output;
+    /* checkpoint every (s)  */ Storage::Checkpoint checkpoint {"cosmological_mesh_leapfrog", 1800};
+
+    //  read ic, pos and vel, or resume from the last checkpoint, which has the state and the cursors of
+    //  storage and output, only the one written to moves
+    decltype(storage)::Cursor cursor {};
+    Storage::N_Body_Raw::Cursor output_cursor {};
+    uint64_t s_0 = 0;
+    auto blocks = [&]() -> std::vector<Storage::Checkpoint::Block>
+    {   return {Storage::Checkpoint::block(state, 6 * n),
+                Storage::Checkpoint::block(&cursor),
+                Storage::Checkpoint::block(&output_cursor)};
+    };
+    if (checkpoint.load(s_0, blocks()))
+    {   if constexpr (raw)
+            output.emplace("cosmological", output_cursor);
+        else
+            storage.seek(cursor);
+    }
+    else
+    {   storage.read(state, state + 3 * n);
+        if constexpr (raw)
+            output.emplace("cosmological", n, store_velocities, n_t / n_s);
+    }
+
+    //  snapshots are written on a background thread, from copies of the state
+    Storage::Async_Writer<> writer {(store_velocities ? 6 : 3) * n, [&](double *const snapshot, const double t)
+    {   if constexpr (raw && store_velocities)
+            output->write(snapshot, snapshot + 3 * n, t);
+        else if constexpr (raw)
+            output->write(snapshot, t);
+        else if constexpr (store_velocities)
+            storage.write(snapshot, snapshot + 3 * n, t);
+        else
+            storage.write(snapshot, t);
+    }};
+
+    //  process state # s, and checkpoint when due
+    auto process = [&](size_t s)
+    {   writer.push(state, s * dt);
+        printf("{%zu}/{%zu}\n", s, n_t);
+        if (checkpoint.due(s))
+        {   writer.flush();
+            if constexpr (raw)
+                output_cursor = output->cursor();
+            else
+                cursor = storage.cursor();
+            checkpoint.save(s, blocks());
+        }
+    };
+
+    //  main loop
+    for (size_t s = s_0 + 1; s <= n_t; s++)
+    {   Mesh_Leapfrog::forward(mesh, acc, state, n, dt);
+        if (s % n_s == 0)
+            process(s);
+    }
+
+    //  the run completed, its checkpoint is dropped once the last snapshots are written and flushed
+    writer.flush();
+    if constexpr (!raw)
+        storage.flush();
+    checkpoint.remove();
+
+    delete[] acc;
+    delete[] state;
+}
@@ -0,0 +1,236 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <fftw3.h>
+#include <omp.h>
+#include <cmath>
+#include <array>
+
+namespace Mesh_Leapfrog
+{
+
+//  particle-mesh gravity in a periodic box [0, box)^3, the resolution may differ per dimension
+//  assignment order 1 is cloud-in-cell, 2 is triangular-shaped-cloud, the same kernel is used
+//  for mass assignment and for interpolation back to the particles, so there is no self force
+//  the Green's function is computed once
+//  with r_split > 0 only the long range part exp(-k^2 r_split^2) of the force is kept, as in TreePM and P3M
+
+template <size_t order = 1, typename = std::enable_if_t<order == 1 || order == 2>>
+struct Mesh
+{
+    static constexpr int n_w = order + 1; // cells touched per dimension
+
+    std::array<int, 3> res;
+    size_t size;            // # real cells
+    size_t size_k;          // # complex cells, last dimension halved
+    double box;
+    std::array<double, 3> h; // cell size per dimension, for a res that is not cubic
+    double G;
+    double mass;            // particle mass
+    double r_split;         // force split scale, 0 for the full force
+    double *rho;            // density, then potential
+    fftw_complex *rho_k;
+    double *green;
+    double *grad;           // acceleration field, 3 components one after the other
+    fftw_plan plan_forward;
+    fftw_plan plan_backward;
+
+    Mesh(const std::array<int, 3> res, const double box, const double G, const double mass,
+         const double r_split = 0)
+        : res {res},
+          size {static_cast<size_t>(res[0]) * res[1] * res[2]},
+          size_k {static_cast<size_t>(res[0]) * res[1] * (res[2] / 2 + 1)},
+          box {box}, h {box / res[0], box / res[1], box / res[2]}, G {G}, mass {mass}, r_split {r_split}
+    {   rho   = fftw_alloc_real(size);
+        rho_k = fftw_alloc_complex(size_k);
+        green = fftw_alloc_real(size_k);
+        grad  = fftw_alloc_real(3 * size);
+        fftw_init_threads();
+        fftw_plan_with_nthreads(omp_get_max_threads());
+        plan_forward  = fftw_plan_dft_r2c_3d(res[0], res[1], res[2], rho, rho_k, FFTW_MEASURE);
+        plan_backward = fftw_plan_dft_c2r_3d(res[0], res[1], res[2], rho_k, rho, FFTW_MEASURE);
+        init_green();
+    }
+
+    ~Mesh()
+    {   fftw_destroy_plan(plan_forward);
+        fftw_destroy_plan(plan_backward);
+        fftw_free(rho);
+        fftw_free(rho_k);
+        fftw_free(green);
+        fftw_free(grad);
+    }
+
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+
+    //  -4 pi G / k^2, divided by size for the FFT normalization
+    //  the assignment window is only deconvolved for split forces, otherwise that only amplifies
+    //  aliased modes near Nyquist, which the split suppresses
+    void init_green() noexcept
+    {   const int half = res[2] / 2 + 1;
+        #pragma omp parallel for collapse(2)
+        for (int i = 0; i < res[0]; i++)
+            for (int j = 0; j < res[1]; j++)
+                for (int l = 0; l < half; l++)
+                {   const double k1 = 2 * M_PI / box * (i <= res[0] / 2 ? i : i - res[0]);
+                    const double k2 = 2 * M_PI / box * (j <= res[1] / 2 ? j : j - res[1]);
+                    const double k3 = 2 * M_PI / box * l;
+                    const double k = k1 * k1 + k2 * k2 + k3 * k3;
+                    const size_t p = (static_cast<size_t>(i) * res[1] + j) * half + l;
+                    green[p] = k == 0 ? 0 : -4 * M_PI * G / (k * size);
+                    if (r_split > 0)
+                    {   const double w = pow(sinc(.5 * k1 * h[0]) * sinc(.5 * k2 * h[1]) * sinc(.5 * k3 * h[2]),
+                                             order + 1);
+                        green[p] *= exp(-k * r_split * r_split) / (w * w);
+                    }
+                }
+    }
+
+    static double sinc(const double a) noexcept
+    {   return a == 0 ? 1 : sin(a) / a;
+    }
+
+    //  first cell and weights of the assignment kernel along one dimension, u in cell units
+    static int weights(const double u, double (&w)[n_w]) noexcept
+    {   if constexpr (order == 1)
+        {   const double first = floor(u);
+            const double d = u - first;
+            w[0] = 1 - d;
+            w[1] = d;
+            return static_cast<int>(first);
+        }
+        else
+        {   const double center = floor(u + .5);
+            const double d = u - center;
+            w[0] = .5 * (.5 - d) * (.5 - d);
+            w[1] = .75 - d * d;
+            w[2] = .5 * (.5 + d) * (.5 + d);
+            return static_cast<int>(center) - 1;
+        }
+    }
+
+    size_t wrap(const int i, const int dim) const noexcept
+    {   return static_cast<size_t>((i % res[dim] + res[dim]) % res[dim]);
+    }
+
+    void assign(const double *const state, const size_t n) noexcept
+    {   for (size_t p = 0; p < size; p++)
+            rho[p] = 0;
+        const double density = mass / (h[0] * h[1] * h[2]);
+        #pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+        {   double w1[n_w], w2[n_w], w3[n_w];
+            const int f1 = weights(state[3*i  ] / h[0], w1);
+            const int f2 = weights(state[3*i+1] / h[1], w2);
+            const int f3 = weights(state[3*i+2] / h[2], w3);
+            for (int a = 0; a < n_w; a++)
+                for (int b = 0; b < n_w; b++)
+                    for (int c = 0; c < n_w; c++)
+                    {   const size_t p = (wrap(f1 + a, 0) * res[1] + wrap(f2 + b, 1)) * res[2] + wrap(f3 + c, 2);
+                        #pragma omp atomic
+                        rho[p] += density * w1[a] * w2[b] * w3[c];
+                    }
+        }
+    }
+
+    //  potential in rho, then acceleration field in grad by 4 point finite differences
+    void solve() noexcept
+    {   fftw_execute(plan_forward);
+        #pragma omp parallel for
+        for (size_t p = 0; p < size_k; p++)
+        {   rho_k[p][0] *= green[p];
+            rho_k[p][1] *= green[p];
+        }
+        fftw_execute(plan_backward);
+
+        const double c1[3] {2. / 3 / h[0], 2. / 3 / h[1], 2. / 3 / h[2]};
+        const double c2[3] {1. / 12 / h[0], 1. / 12 / h[1], 1. / 12 / h[2]};
+        #pragma omp parallel for collapse(2)
+        for (int i = 0; i < res[0]; i++)
+            for (int j = 0; j < res[1]; j++)
+                for (int l = 0; l < res[2]; l++)
+                {   auto phi = [&](const int a, const int b, const int c)
+                    {   return rho[(wrap(a, 0) * res[1] + wrap(b, 1)) * res[2] + wrap(c, 2)];
+                    };
+                    const size_t p = (static_cast<size_t>(i) * res[1] + j) * res[2] + l;
+                    grad[p] = -c1[0] * (phi(i+1, j, l) - phi(i-1, j, l)) + c2[0] * (phi(i+2, j, l) - phi(i-2, j, l));
+                    grad[p+size] = -c1[1] * (phi(i, j+1, l) - phi(i, j-1, l)) + c2[1] * (phi(i, j+2, l) - phi(i, j-2, l));
+                    grad[p+2*size] = -c1[2] * (phi(i, j, l+1) - phi(i, j, l-1)) + c2[2] * (phi(i, j, l+2) - phi(i, j, l-2));
+                }
+    }
+
+    void interpolate(const double *const state, double *const acc, const size_t n) const noexcept
+    {
+        #pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+        {   double w1[n_w], w2[n_w], w3[n_w];
+            const int f1 = weights(state[3*i  ] / h[0], w1);
+            const int f2 = weights(state[3*i+1] / h[1], w2);
+            const int f3 = weights(state[3*i+2] / h[2], w3);
+            double a1 = 0;
+            double a2 = 0;
+            double a3 = 0;
+            for (int a = 0; a < n_w; a++)
+                for (int b = 0; b < n_w; b++)
+                    for (int c = 0; c < n_w; c++)
+                    {   const size_t p = (wrap(f1 + a, 0) * res[1] + wrap(f2 + b, 1)) * res[2] + wrap(f3 + c, 2);
+                        const double w = w1[a] * w2[b] * w3[c];
+                        a1 += w * grad[p];
+                        a2 += w * grad[p+size];
+                        a3 += w * grad[p+2*size];
+                    }
+            acc[3*i  ] = a1;
+            acc[3*i+1] = a2;
+            acc[3*i+2] = a3;
+        }
+    }
+
+    void accelerate(const double *const state, double *const acc, const size_t n) noexcept
+    {   assign(state, n);
+        solve();
+        interpolate(state, acc, n);
+    }
+};
+
+//  same kick-drift step as Direct_Leapfrog with mesh forces, positions are wrapped into the box
+//  acc is a buffer of 3 * n
+template <size_t order>
+void forward(Mesh<order> &mesh, double *const acc, double *const state, const size_t n,
+             const double dt) noexcept
+{
+    mesh.accelerate(state, acc, n);
+
+    const double box = mesh.box;
+    #pragma omp parallel for default(none) shared(acc, n, state, dt, box)
+    for (size_t i = 0; i < n; i++)
+        for (size_t d = 0; d < 3; d++)
+        {   state[3*(i+n)+d] += acc[3*i+d] * dt;
+            state[3*i+d] += state[3*(i+n)+d] * dt;
+            state[3*i+d] -= box * floor(state[3*i+d] / box);
+        }
+}
+
+};
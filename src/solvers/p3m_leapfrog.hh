@@ -0,0 +1,173 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "mesh_leapfrog.hh"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace P3m_Leapfrog
+{
+
+//  particle-particle particle-mesh gravity in a periodic box [0, box)^3
+//  the force is split at scale r_split (Springel 2005): the long range part is solved on the mesh,
+//  the short range part -G m / r^2 (erfc(r / 2 r_split) + r / (r_split sqrt pi) exp(-r^2 / 4 r_split^2))
+//  is summed directly over the neighbours within r_cut, found through a cell list of cells >= r_cut
+//  a cell list needs r_cut <= box / 3 to visit every neighbour cell once
+
+template <size_t order = 2, size_t n_table = 1024>
+struct P3m
+{
+    Mesh_Leapfrog::Mesh<order> mesh;
+    double r_split;
+    double r_cut;
+    double eps2;
+    int n_cells;                    // cells per dimension
+    double cell;                    // cell size
+    std::vector<size_t> start;      // first body of every cell in cell order, and the total at the end
+    std::vector<size_t> index;      // body indices in cell order
+    std::vector<size_t> cell_of;
+    std::vector<double> pos;        // positions in cell order
+    std::vector<double> table;      // short range factor erfc(u) + 2 u / sqrt(pi) exp(-u^2) over [0, r_cut]
+
+    P3m(const std::array<int, 3> res, const double box, const double G, const double mass,
+        const double r_split, const double r_cut, const double eps2)
+        : mesh {res, box, G, mass, r_split},
+          r_split {r_split}, r_cut {r_cut}, eps2 {eps2},
+          n_cells {std::max(1, static_cast<int>(box / r_cut))},
+          cell {box / n_cells},
+          start(static_cast<size_t>(n_cells) * n_cells * n_cells + 1),
+          table(n_table + 2)
+    {   for (size_t i = 0; i < table.size(); i++)
+        {   const double u = .5 * r_cut * i / n_table / r_split;
+            table[i] = erfc(u) + 2 * u / sqrt(M_PI) * exp(-u * u);
+        }
+    }
+
+    //  counting sort of the bodies into their cells
+    void sort(const double *const state, const size_t n)
+    {   index.resize(n);
+        cell_of.resize(n);
+        pos.resize(3 * n);
+        std::fill(start.begin(), start.end(), 0);
+        #pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+        {   const int c1 = std::min(static_cast<int>(state[3*i  ] / cell), n_cells - 1);
+            const int c2 = std::min(static_cast<int>(state[3*i+1] / cell), n_cells - 1);
+            const int c3 = std::min(static_cast<int>(state[3*i+2] / cell), n_cells - 1);
+            cell_of[i] = (static_cast<size_t>(c1) * n_cells + c2) * n_cells + c3;
+        }
+        for (size_t i = 0; i < n; i++)
+            start[cell_of[i]+1]++;
+        for (size_t c = 1; c < start.size(); c++)
+            start[c] += start[c-1];
+        std::vector<size_t> fill {start.begin(), start.end() - 1};
+        for (size_t i = 0; i < n; i++)
+            index[fill[cell_of[i]]++] = i;
+        #pragma omp parallel for
+        for (size_t k = 0; k < n; k++)
+            for (size_t d = 0; d < 3; d++)
+                pos[3*k+d] = state[3*index[k]+d];
+    }
+
+    //  adds the short range acceleration, acc is in original order
+    void short_range(double *const acc) const noexcept
+    {   const double box = mesh.box;
+        const double gm = mesh.G * mesh.mass;
+        const double r_cut2 = r_cut * r_cut;
+        const double scale = n_table / r_cut;
+        const int lo = n_cells >= 3 ? -1 : 0;
+        const int hi = n_cells >= 2 ? 1 : 0;
+        #pragma omp parallel for collapse(3) schedule(dynamic)
+        for (int c1 = 0; c1 < n_cells; c1++)
+            for (int c2 = 0; c2 < n_cells; c2++)
+                for (int c3 = 0; c3 < n_cells; c3++)
+                {   const size_t c = (static_cast<size_t>(c1) * n_cells + c2) * n_cells + c3;
+                    for (size_t k = start[c]; k < start[c+1]; k++)
+                    {   double a1 = 0;
+                        double a2 = 0;
+                        double a3 = 0;
+                        for (int o1 = lo; o1 <= hi; o1++)
+                            for (int o2 = lo; o2 <= hi; o2++)
+                                for (int o3 = lo; o3 <= hi; o3++)
+                                {   const size_t d = ((static_cast<size_t>((c1 + o1 + n_cells) % n_cells)) * n_cells +
+                                                       (c2 + o2 + n_cells) % n_cells) * n_cells +
+                                                       (c3 + o3 + n_cells) % n_cells;
+                                    for (size_t l = start[d]; l < start[d+1]; l++)
+                                    {   //  minimum image
+                                        double b1 = pos[3*k  ] - pos[3*l  ];
+                                        double b2 = pos[3*k+1] - pos[3*l+1];
+                                        double b3 = pos[3*k+2] - pos[3*l+2];
+                                        b1 -= box * std::round(b1 / box);
+                                        b2 -= box * std::round(b2 / box);
+                                        b3 -= box * std::round(b3 / box);
+                                        const double r2 = b1 * b1 + b2 * b2 + b3 * b3;
+                                        if (r2 >= r_cut2)
+                                            continue;
+                                        //  the body itself contributes nothing since eps2 > 0
+                                        const double u = sqrt(r2) * scale;
+                                        const size_t t = static_cast<size_t>(u);
+                                        const double f = table[t] + (u - t) * (table[t+1] - table[t]);
+                                        double e = 1 / sqrt(r2 + eps2);
+                                        e = gm * f * e * e * e;
+                                        a1 -= e * b1;
+                                        a2 -= e * b2;
+                                        a3 -= e * b3;
+                                    }
+                                }
+                        const size_t i = index[k];
+                        acc[3*i  ] += a1;
+                        acc[3*i+1] += a2;
+                        acc[3*i+2] += a3;
+                    }
+                }
+    }
+
+    void accelerate(const double *const state, double *const acc, const size_t n)
+    {   mesh.accelerate(state, acc, n);
+        sort(state, n);
+        short_range(acc);
+    }
+};
+
+//  same kick-drift step as Direct_Leapfrog with P3M forces, positions are wrapped into the box
+//  acc is a buffer of 3 * n
+template <size_t order, size_t n_table>
+void forward(P3m<order, n_table> &p3m, double *const acc, double *const state, const size_t n,
+             const double dt)
+{
+    p3m.accelerate(state, acc, n);
+
+    const double box = p3m.mesh.box;
+    #pragma omp parallel for default(none) shared(acc, n, state, dt, box)
+    for (size_t i = 0; i < n; i++)
+        for (size_t d = 0; d < 3; d++)
+        {   state[3*(i+n)+d] += acc[3*i+d] * dt;
+            state[3*i+d] += state[3*(i+n)+d] * dt;
+            state[3*i+d] -= box * floor(state[3*i+d] / box);
+        }
+}
+
+};
@@ -0,0 +1,126 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include "octree.hh"
+#include <cmath>
+#include <vector>
+
+namespace Tree_Leapfrog
+{
+
+//  Barnes-Hut acceleration of every body in Morton order, walking the tree once per body
+//  a node is accepted when the body is further from its com than s / theta + delta (Barnes 1994),
+//  so a node can never be accepted by a body inside it, and is then applied up to quadrupole order
+template <size_t n_leaf, size_t n_task>
+void accelerate(const Octree<n_leaf, n_task> &tree, double *const acc, const size_t n,
+                const double eps2, const double theta) noexcept
+{
+    //  8 pending children per level at most
+    constexpr size_t stack_size = 8 * (Octree<n_leaf, n_task>::n_bits + 1);
+
+    #pragma omp parallel default(none) shared(tree, acc, n, eps2, theta, stack_size)
+    #pragma omp single
+    #pragma omp taskloop grainsize(256)
+    for (size_t k = 0; k < n; k++)
+    {   const double p1 = tree.pos[3*k  ];
+        const double p2 = tree.pos[3*k+1];
+        const double p3 = tree.pos[3*k+2];
+        double a1 = 0;
+        double a2 = 0;
+        double a3 = 0;
+        size_t stack[stack_size];
+        size_t top = 0;
+        stack[top++] = 0;
+        while (top != 0)
+        {   const auto &node = tree.nodes[stack[--top]];
+            if (node.mass == 0)
+                continue;
+            const double b1 = p1 - node.com[0];
+            const double b2 = p2 - node.com[1];
+            const double b3 = p3 - node.com[2];
+            const double b = b1 * b1 + b2 * b2 + b3 * b3;
+            const double r_open = 2 * node.half / theta + node.delta;
+            if (b > r_open * r_open)
+            {   //  a = -M x / r^3 + Q x / r^5 - 5/2 (x Q x) x / r^7, softened
+                const double r2 = 1 / (b + eps2);
+                const double r1 = sqrt(r2);
+                const double r3 = r1 * r2;
+                const double r5 = r3 * r2;
+                const double r7 = r5 * r2;
+                const double q1 = node.quad[0] * b1 + node.quad[1] * b2 + node.quad[2] * b3;
+                const double q2 = node.quad[1] * b1 + node.quad[3] * b2 + node.quad[4] * b3;
+                const double q3 = node.quad[2] * b1 + node.quad[4] * b2 + node.quad[5] * b3;
+                const double c = -node.mass * r3 - 2.5 * (q1 * b1 + q2 * b2 + q3 * b3) * r7;
+                a1 += c * b1 + q1 * r5;
+                a2 += c * b2 + q2 * r5;
+                a3 += c * b3 + q3 * r5;
+            }
+            else if (node.child == 0)
+            {   //  direct, the body itself contributes nothing since eps2 > 0
+                for (size_t l = node.begin; l < node.end; l++)
+                {   const double d1 = p1 - tree.pos[3*l  ];
+                    const double d2 = p2 - tree.pos[3*l+1];
+                    const double d3 = p3 - tree.pos[3*l+2];
+                    double c = 1 / sqrt(d1 * d1 +
+                                        d2 * d2 +
+                                        d3 * d3 + eps2);
+                    c = c * c * c;
+                    a1 -= c * d1;
+                    a2 -= c * d2;
+                    a3 -= c * d3;
+                }
+            }
+            else
+                for (size_t i = 0; i < 8; i++)
+                    stack[top++] = node.child + i;
+        }
+        acc[3*k  ] = a1;
+        acc[3*k+1] = a2;
+        acc[3*k+2] = a3;
+    }
+}
+
+//  same kick-drift step as Direct_Leapfrog, with tree forces
+//  acc is a buffer of 3 * n, tree is kept between steps so its storage is reused
+template <size_t n_leaf, size_t n_task>
+void forward(Octree<n_leaf, n_task> &tree, double *const acc, double *const state, const size_t n,
+             const double dt, const double eps2, const double theta)
+{
+    tree.build(state, n);
+    accelerate(tree, acc, n, eps2, theta);
+
+    #pragma omp parallel for default(none) shared(tree, acc, n, state, dt)
+    for (size_t k = 0; k < n; k++)
+    {   const size_t i = tree.keys[k].second;
+        state[3*(i+n)  ] += acc[3*k  ] * dt;
+        state[3*(i+n)+1] += acc[3*k+1] * dt;
+        state[3*(i+n)+2] += acc[3*k+2] * dt;
+        state[3*i  ] += state[3*(i+n)  ] * dt;
+        state[3*i+1] += state[3*(i+n)+1] * dt;
+        state[3*i+2] += state[3*(i+n)+2] * dt;
+    }
+}
+
+};
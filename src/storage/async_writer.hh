@@ -0,0 +1,140 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <cstring>
+
+namespace Storage
+{
+
+//  runs the writes of a storage backend on a background thread, so the integrator only waits for a copy
+//  snapshots of size doubles go through n_slots buffers: the integrator fills the next free one (acquire),
+//  hands it over (submit) and continues, the thread writes the slots in order via write(snapshot, time)
+//  acquire blocks while all slots still wait to be written, so a slow disk throttles the run instead of
+//  piling up snapshots, and an exception of write is rethrown by the next acquire or flush
+//  write may point the storage buffers at the snapshot, it stays untouched until write returns
+
+template <size_t n_slots = 2>
+class Async_Writer
+{
+    static_assert(n_slots >= 1);
+
+    std::function<void(double *, double)> write;
+    size_t size;
+    double *data;
+    double times[n_slots];
+    size_t filled = 0;          // # submitted snapshots
+    size_t written = 0;         // # written snapshots
+    bool stop = false;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    void run()
+    {   std::unique_lock<std::mutex> lock {mutex};
+        while (true)
+        {   changed.wait(lock, [&] { return stop || written < filled; });
+            if (written == filled)
+                return;
+            const size_t slot = written % n_slots;
+            lock.unlock();
+            try
+            {   write(data + slot * size, times[slot]);
+            }
+            catch (...)
+            {   lock.lock();
+                error = std::current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+            written++;
+            changed.notify_all();
+        }
+    }
+
+    void check()
+    {   if (error)
+        {   std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+public:
+    template <typename F>
+    Async_Writer(const size_t size, F &&write)
+        : write {std::forward<F>(write)}, size {size}, data {new double[n_slots * size]}
+    {   thread = std::thread {&Async_Writer::run, this};
+    }
+
+    ~Async_Writer()
+    {   {   std::lock_guard<std::mutex> lock {mutex};
+            stop = true;
+        }
+        changed.notify_all();
+        thread.join();
+        delete[] data;
+    }
+
+    Async_Writer(const Async_Writer &) = delete;
+    Async_Writer &operator=(const Async_Writer &) = delete;
+
+    //  buffer of size doubles for the next snapshot, waits for a free slot
+    double *acquire()
+    {   std::unique_lock<std::mutex> lock {mutex};
+        changed.wait(lock, [&] { return filled - written < n_slots; });
+        check();
+        return data + (filled % n_slots) * size;
+    }
+
+    //  queue the acquired buffer
+    void submit(const double time)
+    {   {   std::lock_guard<std::mutex> lock {mutex};
+            times[filled % n_slots] = time;
+            filled++;
+        }
+        changed.notify_all();
+    }
+
+    //  copy a snapshot and queue it
+    void push(const double *const snapshot, const double time)
+    {   memcpy(acquire(), snapshot, size * sizeof(double));
+        submit(time);
+    }
+
+    //  wait until all queued snapshots are written
+    void flush()
+    {   std::unique_lock<std::mutex> lock {mutex};
+        changed.wait(lock, [&] { return written == filled; });
+        check();
+    }
+};
+
+}
@@ -0,0 +1,188 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <system_error>
+#include <utility>
+#include <stdexcept>
+
+namespace Storage
+{
+
+//  solver state dumps to resume a run exactly
+//  a checkpoint is a list of raw memory blocks, the complete state of the solver and of its storage cursors,
+//  written one after the other to name.checkpoint.tmp, synced, then renamed over name.checkpoint and the directory
+//  synced, so a crash or power loss while saving leaves the previous checkpoint intact
+//  the block sizes are stored and checked on load, the contents are the responsibility of the driver
+
+class Checkpoint
+{
+    static constexpr char magic[8] {'G', 'R', 'A', 'V', 'C', 'K', 'P', 'T'};
+
+    std::string name;
+    double wall_interval;
+    size_t step_interval;
+    std::chrono::steady_clock::time_point last;
+
+    static void check(const bool ok, const char *what)
+    {   if (!ok)
+            throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    //  owns a file descriptor, so it is closed also when a read, write or check throws
+    struct File
+    {
+        int fd;
+
+        explicit File(const int fd) noexcept
+            : fd {fd}
+        {}
+
+        ~File()
+        {   if (fd != -1)
+                close(fd);
+        }
+
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+
+        //  close now, reporting the error
+        void close_checked(const char *what)
+        {   check(close(std::exchange(fd, -1)) == 0, what);
+        }
+    };
+
+    //  makes the rename durable
+    void sync_directory() const
+    {   const size_t slash = name.rfind('/');
+        const std::string directory = slash == std::string::npos ? "." : name.substr(0, slash + 1);
+        File dir {open(directory.c_str(), O_RDONLY | O_DIRECTORY)};
+        check(dir.fd != -1, "Checkpoint open directory");
+        check(fsync(dir.fd) == 0, "Checkpoint fsync directory");
+        dir.close_checked("Checkpoint close directory");
+    }
+
+    static void write_all(const int fd, const void *const buffer, const size_t bytes)
+    {   const char *p = static_cast<const char *>(buffer);
+        size_t done = 0;
+        while (done < bytes)
+        {   const ssize_t w = ::write(fd, p + done, bytes - done);
+            check(w > 0, "Checkpoint write");
+            done += w;
+        }
+    }
+
+    static void read_all(const int fd, void *const buffer, const size_t bytes)
+    {   char *p = static_cast<char *>(buffer);
+        size_t done = 0;
+        while (done < bytes)
+        {   const ssize_t r = ::read(fd, p + done, bytes - done);
+            check(r >= 0, "Checkpoint read");
+            if (r == 0)
+                throw std::runtime_error("Checkpoint: file ends early");
+            done += r;
+        }
+    }
+
+public:
+    struct Block
+    {
+        void *data;
+        size_t bytes;
+    };
+
+    template <typename T>
+    static Block block(T *const data, const size_t count = 1) noexcept
+    {   return {static_cast<void *>(data), count * sizeof(T)};
+    }
+
+    //  saves when wall_interval seconds passed since the last save, or every step_interval steps, 0 disables either
+    Checkpoint(std::string name, const double wall_interval, const size_t step_interval = 0)
+        : name {std::move(name) + ".checkpoint"}, wall_interval {wall_interval}, step_interval {step_interval},
+          last {std::chrono::steady_clock::now()}
+    {}
+
+    bool due(const size_t step) const
+    {   if (step_interval != 0 && step % step_interval == 0)
+            return true;
+        const std::chrono::duration<double> since = std::chrono::steady_clock::now() - last;
+        return wall_interval > 0 && since.count() >= wall_interval;
+    }
+
+    void save(const uint64_t step, const std::vector<Block> &blocks)
+    {   const std::string tmp = name + ".tmp";
+        File file {open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+        check(file.fd != -1, "Checkpoint open");
+        std::vector<uint64_t> header {0, step, blocks.size()};
+        memcpy(header.data(), magic, sizeof(magic));
+        for (const Block &b : blocks)
+            header.push_back(b.bytes);
+        write_all(file.fd, header.data(), header.size() * sizeof(uint64_t));
+        for (const Block &b : blocks)
+            write_all(file.fd, b.data, b.bytes);
+        check(fsync(file.fd) == 0, "Checkpoint fsync");
+        file.close_checked("Checkpoint close");
+        check(rename(tmp.c_str(), name.c_str()) == 0, "Checkpoint rename");
+        sync_directory();
+        last = std::chrono::steady_clock::now();
+    }
+
+    //  drops the checkpoint once the run it belongs to completed, so the next run starts from its ic
+    void remove() const
+    {   check(unlink(name.c_str()) == 0 || errno == ENOENT, "Checkpoint remove");
+    }
+
+    //  fills the blocks and step from the last checkpoint, false when there is none
+    bool load(uint64_t &step, const std::vector<Block> &blocks) const
+    {   File file {open(name.c_str(), O_RDONLY)};
+        if (file.fd == -1 && errno == ENOENT)
+            return false;
+        check(file.fd != -1, "Checkpoint open");
+        std::vector<uint64_t> header(3);
+        read_all(file.fd, header.data(), 3 * sizeof(uint64_t));
+        if (memcmp(header.data(), magic, sizeof(magic)) != 0 || header[2] != blocks.size())
+            throw std::runtime_error("Checkpoint: " + name + " does not match this solver");
+        header.resize(3 + blocks.size());
+        read_all(file.fd, &header[3], blocks.size() * sizeof(uint64_t));
+        size_t i = 3;
+        for (const Block &b : blocks)
+            if (header[i++] != b.bytes)
+                throw std::runtime_error("Checkpoint: " + name + " does not match the sizes of this run");
+        for (const Block &b : blocks)
+            read_all(file.fd, b.data, b.bytes);
+        step = header[1];
+        return true;
+    }
+};
+
+}
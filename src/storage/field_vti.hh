@@ -30,11 +30,14 @@
 #include <vtkDoubleArray.h>
 #include <vtkPointData.h>
 #include <vtkAbstractArray.h>
+#include <vtkInformation.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
 #include <string>
 #include <cstring>
 #include <type_traits>
 #include <utility>
 #include <algorithm>
+#include <stdexcept>
 #include <fftw3.h>
 
 namespace Storage
@@ -56,6 +59,7 @@ class Field_vti
     vtkDoubleArray        *vel    = NULL;
     std::array<int, order> res;
     size_t time_count = 0;
+    bool started = false;   // whether the writer has a file open
     std::string name_no_suffix;
 
     void pre_read()
@@ -100,7 +104,8 @@ public:
 
     ~Field_vti()
     {   if (writer != NULL)
-        {   writer->Stop();
+        {   if (started)
+                writer->Stop();
             rho->Delete();
             if (vel != NULL)
                 vel->Delete();
@@ -124,7 +129,7 @@ public:
         double *rho_raw = rho->GetPointer(0);
         double *vel_raw = vel->GetPointer(0);
         memcpy(rho_buffer, rho_raw, res[0] * res[1] * (order == 3 ? res[2] : 1)         * sizeof(double));
-        memcpy(vel_buffer, vel_raw, res[0] * res[1] * (order == 3 ? res[2] : 1) * order * sizeof(double))
+        memcpy(vel_buffer, vel_raw, res[0] * res[1] * (order == 3 ? res[2] : 1) * order * sizeof(double));
         reader->Delete();
         reader = NULL;
         pre_write();
@@ -132,6 +137,29 @@ public:
         write(0);
     }
 
+    //  position of the next snapshot, for checkpoints
+    size_t cursor() const
+    {   return time_count;
+    }
+
+    //  instead of read when resuming at a cursor: writes from the buffers without an initial snapshot,
+    //  a partly written file is continued in a new one with the cursor appended, so no file is overwritten
+    void resume(double *const rho_buffer, double *const vel_buffer, const size_t count)
+    {   if (image == NULL)
+            pre_read();
+        reader->Delete();
+        reader = NULL;
+        pre_write();
+        set_buffers(rho_buffer, vel_buffer);
+        time_count = count;
+        if (time_count % time_steps_per_file != 0)
+        {   writer->SetFileName((name_no_suffix + "_" + std::to_string(time_count / time_steps_per_file)
+                                 + "_" + std::to_string(time_count)).c_str());
+            writer->Start();
+            started = true;
+        }
+    }
+
     void set_buffer(double *const rho_buffer)
     {   rho->SetVoidArray(rho_buffer, res[0] * res[1] * (order == 3 ? res[2] : 1), 1);
     }
@@ -148,11 +176,11 @@ public:
 
     void write(const double time)
     {   if (time_count % time_steps_per_file == 0)
-        {   if (time_count != 0)
+        {   if (started)
                 writer->Stop();
-            std::string = ;
             writer->SetFileName((name_no_suffix + "_" + std::to_string(time_count / time_steps_per_file)).c_str());
             writer->Start();
+            started = true;
         }
         rho->Modified();
         if (vel != NULL)
@@ -162,4 +190,21 @@ public:
     }
 };
 
+//  2 or 3, the dimension of the grid in name.vti, to choose the order of Field_vti at run time,
+//  only the header is read, a missing or foreign file throws instead of picking either
+size_t field_vti_order(const std::string &name)
+{   const std::string file = name + ".vti";
+    vtkXMLImageDataReader *reader = vtkXMLImageDataReader::New();
+    if (!reader->CanReadFile(file.c_str()))
+    {   reader->Delete();
+        throw std::runtime_error("Field_vti: cannot read " + file);
+    }
+    reader->SetFileName(file.c_str());
+    reader->UpdateInformation();
+    int extent[6];
+    reader->GetOutputInformation(0)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), extent);
+    reader->Delete();
+    return extent[5] > extent[4] ? 3 : 2;
+}
+
 }
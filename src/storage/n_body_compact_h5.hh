@@ -0,0 +1,364 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <H5Cpp.h>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Storage
+{
+
+using namespace H5;
+
+//  time dependent 3D n-body storage via HDF5, lossy and compact, for large runs
+//  positions and velocities are stored as fixed point codes of pos_bits and vel_bits in a box per dimension,
+//  so the error is at most half the box over 2^bits - 1. the box is chosen with a margin when a snapshot
+//  leaves the current one, and kept as long as possible, since codes are stored as differences with the last
+//  snapshot (zigzag encoded, so small differences have small unsigned codes), byte shuffled and deflated
+//  every keyframe_interval snapshots, and whenever the box changes, a keyframe stores the codes themselves,
+//  so reading a snapshot decodes at most keyframe_interval rows
+//  layout: pos, vel [t, n, 3] uint32, time [t], box [t, 12] (pos lo, pos hi, vel lo, vel hi), key [t] uint8
+//  snapshots are appended a whole chunk at a time, the rest on flush or destruction
+
+template <unsigned pos_bits = 24, unsigned vel_bits = 16, hsize_t keyframe_interval = 64, hsize_t time_chunk_size = 16>
+struct N_Body_Compact_h5
+{
+    static_assert(pos_bits > 0 && pos_bits < 32 && vel_bits > 0 && vel_bits < 32);
+
+    H5File file;
+    hsize_t n;
+    bool velocities;
+    hsize_t size;                       // # snapshots written
+    DataSet pos_set;
+    DataSet vel_set;
+    DataSet time_set;
+    DataSet box_set;
+    DataSet key_set;
+    double box[12] {};                  // of the last snapshot, vel half unused without velocities
+    std::vector<uint32_t> pos_codes;    // of the last snapshot
+    std::vector<uint32_t> vel_codes;
+    std::vector<uint32_t> codes;        // of the snapshot being written
+    hsize_t since_key = keyframe_interval;
+    std::vector<uint32_t> pos_pending;  // encoded snapshots not written yet
+    std::vector<uint32_t> vel_pending;
+    std::vector<double> time_pending;
+    std::vector<double> box_pending;
+    std::vector<uint8_t> key_pending;
+    hsize_t n_pending = 0;
+    std::vector<uint8_t> keys;          // when reading
+
+    //  new file for n objects, velocities are stored also if asked
+    N_Body_Compact_h5(std::string name, const hsize_t n, const bool velocities)
+        : file {std::move(name) + ".h5", H5F_ACC_TRUNC}, n {n}, velocities {velocities}, size {0},
+          pos_codes(3 * n), codes(3 * n), pos_pending(time_chunk_size * n * 3),
+          time_pending(time_chunk_size), box_pending(time_chunk_size * 12), key_pending(time_chunk_size)
+    {   hsize_t shape[3] {0, n, 3};
+        hsize_t max_shape[3] {H5S_UNLIMITED, n, 3};
+        hsize_t chunk_shape[3] {time_chunk_size, n, 3};
+        DSetCreatPropList properties;
+        properties.setChunk(3, chunk_shape);
+        properties.setShuffle();
+        properties.setDeflate(4);
+        DataSpace space {3, shape, max_shape};
+        pos_set = file.createDataSet("pos", PredType::NATIVE_UINT32, space, properties);
+        if (velocities)
+        {   vel_set = file.createDataSet("vel", PredType::NATIVE_UINT32, space, properties);
+            vel_codes.resize(3 * n);
+            vel_pending.resize(time_chunk_size * n * 3);
+        }
+        hsize_t box_shape[2] {0, 12};
+        hsize_t box_max_shape[2] {H5S_UNLIMITED, 12};
+        hsize_t box_chunk_shape[2] {time_chunk_size, 12};
+        DSetCreatPropList box_properties;
+        box_properties.setChunk(2, box_chunk_shape);
+        box_set = file.createDataSet("box", PredType::NATIVE_DOUBLE, DataSpace {2, box_shape, box_max_shape}, box_properties);
+        DSetCreatPropList time_properties;
+        time_properties.setChunk(1, chunk_shape);
+        time_set = file.createDataSet("time", PredType::NATIVE_DOUBLE, DataSpace {1, shape, max_shape}, time_properties);
+        key_set = file.createDataSet("key", PredType::NATIVE_UINT8, DataSpace {1, shape, max_shape}, time_properties);
+        const unsigned bits[2] {pos_bits, vel_bits};
+        hsize_t bits_shape[1] {2};
+        file.createAttribute("bits", PredType::NATIVE_UINT, DataSpace {1, bits_shape}).write(PredType::NATIVE_UINT, bits);
+    }
+
+    //  existing file, for reading
+    explicit N_Body_Compact_h5(std::string name)
+        : file {std::move(name) + ".h5", H5F_ACC_RDONLY}
+    {   pos_set  = file.openDataSet("pos");
+        time_set = file.openDataSet("time");
+        box_set  = file.openDataSet("box");
+        key_set  = file.openDataSet("key");
+        velocities = file.nameExists("vel");
+        if (velocities)
+            vel_set = file.openDataSet("vel");
+        hsize_t shape[3];
+        pos_set.getSpace().getSimpleExtentDims(shape);
+        size = shape[0];
+        n = shape[1];
+        keys.resize(size);
+        if (size != 0)
+            key_set.read(keys.data(), PredType::NATIVE_UINT8);
+    }
+
+    //  position of the next snapshot, for checkpoints, buffered snapshots are written first
+    struct Cursor
+    {
+        uint64_t size;
+    };
+
+    Cursor cursor()
+    {   flush();
+        return {size};
+    }
+
+    //  existing file, to continue writing at a cursor, dropping the snapshots after it
+    //  the codes of the last snapshot are not kept, so the next one is a keyframe
+    N_Body_Compact_h5(std::string name, const Cursor at)
+        : file {std::move(name) + ".h5", H5F_ACC_RDWR}, size {at.size},
+          time_pending(time_chunk_size), box_pending(time_chunk_size * 12), key_pending(time_chunk_size)
+    {   unsigned bits[2];
+        file.openAttribute("bits").read(PredType::NATIVE_UINT, bits);
+        if (bits[0] != pos_bits || bits[1] != vel_bits)
+            throw std::invalid_argument("N_Body_Compact_h5: file has other code bits");
+        pos_set  = file.openDataSet("pos");
+        time_set = file.openDataSet("time");
+        box_set  = file.openDataSet("box");
+        key_set  = file.openDataSet("key");
+        velocities = file.nameExists("vel");
+        hsize_t shape[3];
+        pos_set.getSpace().getSimpleExtentDims(shape);
+        if (size > shape[0])
+            throw std::invalid_argument("N_Body_Compact_h5: file ends before the cursor");
+        n = shape[1];
+        pos_codes.resize(3 * n);
+        codes.resize(3 * n);
+        pos_pending.resize(time_chunk_size * n * 3);
+        shape[0] = size;
+        pos_set.extend(shape);
+        if (velocities)
+        {   vel_set = file.openDataSet("vel");
+            vel_set.extend(shape);
+            vel_codes.resize(3 * n);
+            vel_pending.resize(time_chunk_size * n * 3);
+        }
+        time_set.extend(shape);
+        key_set.extend(shape);
+        hsize_t box_shape[2] {size, 12};
+        box_set.extend(box_shape);
+    }
+
+    //  drivers flush before exit to see write errors, here they can only be reported, not thrown
+    ~N_Body_Compact_h5()
+    {   try
+        {   flush();
+            file.close();
+        }
+        catch (const Exception &e)
+        {   fprintf(stderr, "N_Body_Compact_h5: snapshots may be lost, %s\n", e.getCDetailMsg());
+        }
+    }
+
+    N_Body_Compact_h5(const N_Body_Compact_h5 &) = delete;
+    N_Body_Compact_h5 &operator=(const N_Body_Compact_h5 &) = delete;
+
+    hsize_t n_objects() const
+    {   return n;
+    }
+
+    hsize_t n_snapshots() const
+    {   return size;
+    }
+
+    //  only for files without velocities
+    void write(const double *const pos_buffer, const double time)
+    {   if (velocities)
+            throw std::invalid_argument("N_Body_Compact_h5: file stores velocities, write them too");
+        encode(pos_buffer, nullptr, time);
+    }
+
+    //  only for files with velocities
+    void write(const double *const pos_buffer, const double *const vel_buffer, const double time)
+    {   if (!velocities)
+            throw std::invalid_argument("N_Body_Compact_h5: file stores no velocities");
+        encode(pos_buffer, vel_buffer, time);
+    }
+
+    //  append the buffered snapshots
+    void flush()
+    {   if (n_pending == 0)
+            return;
+        hsize_t shape[3] {size + n_pending, n, 3};
+        hsize_t slab_shape[3] {n_pending, n, 3};
+        hsize_t slab_offset[3] {size, 0, 0};
+        append(pos_set, 3, shape, slab_shape, slab_offset, pos_pending.data(), PredType::NATIVE_UINT32);
+        if (velocities)
+            append(vel_set, 3, shape, slab_shape, slab_offset, vel_pending.data(), PredType::NATIVE_UINT32);
+        append(time_set, 1, shape, slab_shape, slab_offset, time_pending.data(), PredType::NATIVE_DOUBLE);
+        append(key_set, 1, shape, slab_shape, slab_offset, key_pending.data(), PredType::NATIVE_UINT8);
+        hsize_t box_shape[2] {size + n_pending, 12};
+        hsize_t box_slab_shape[2] {n_pending, 12};
+        append(box_set, 2, box_shape, box_slab_shape, slab_offset, box_pending.data(), PredType::NATIVE_DOUBLE);
+        size += n_pending;
+        n_pending = 0;
+    }
+
+    //  snapshot t, decoded from the last keyframe
+    void read(double *const pos_buffer, const hsize_t t) const
+    {   decode(pos_set, 0, t, pos_buffer);
+    }
+
+    void read(double *const pos_buffer, double *const vel_buffer, const hsize_t t) const
+    {   decode(pos_set, 0, t, pos_buffer);
+        decode(vel_set, 1, t, vel_buffer);
+    }
+
+    double time(const hsize_t t) const
+    {   double value;
+        hsize_t slab_shape[1] {1};
+        hsize_t slab_offset[1] {t};
+        DataSpace space = time_set.getSpace();
+        space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+        time_set.read(&value, PredType::NATIVE_DOUBLE, DataSpace {1, slab_shape}, space);
+        return value;
+    }
+
+private:
+    static uint32_t zigzag(const int64_t d) noexcept
+    {   return static_cast<uint32_t>(d < 0 ? -2 * d - 1 : 2 * d);
+    }
+
+    static int64_t unzigzag(const uint32_t z) noexcept
+    {   return z & 1 ? -static_cast<int64_t>(z >> 1) - 1 : static_cast<int64_t>(z >> 1);
+    }
+
+    //  whether x lies in the box [lo, hi] per dimension
+    bool fits(const double *const x, const double *const lo, const double *const hi) const noexcept
+    {   for (size_t i = 0; i < n; i++)
+            for (size_t d = 0; d < 3; d++)
+                if (!(x[3*i+d] >= lo[d] && x[3*i+d] <= hi[d]))
+                    return false;
+        return true;
+    }
+
+    //  bounds of x, widened by a quarter on both sides so that the box lasts
+    void choose_box(const double *const x, double *const lo, double *const hi) const noexcept
+    {   for (size_t d = 0; d < 3; d++)
+        {   lo[d] = INFINITY;
+            hi[d] = -INFINITY;
+        }
+        for (size_t i = 0; i < n; i++)
+            for (size_t d = 0; d < 3; d++)
+            {   lo[d] = std::min(lo[d], x[3*i+d]);
+                hi[d] = std::max(hi[d], x[3*i+d]);
+            }
+        for (size_t d = 0; d < 3; d++)
+        {   const double margin = hi[d] > lo[d] ? .25 * (hi[d] - lo[d]) : 1;
+            lo[d] -= margin;
+            hi[d] += margin;
+        }
+    }
+
+    //  fixed point codes of x into codes, and what to store for them into out, updating last
+    void quantize(const double *const x, const double *const lo, const double *const hi, const unsigned bits,
+                  const bool key, std::vector<uint32_t> &last, uint32_t *const out) noexcept
+    {   const double top = static_cast<double>((uint32_t {1} << bits) - 1);
+        const double scale[3] {top / (hi[0] - lo[0]), top / (hi[1] - lo[1]), top / (hi[2] - lo[2])};
+        for (size_t i = 0; i < n; i++)
+            for (size_t d = 0; d < 3; d++)
+                codes[3*i+d] = static_cast<uint32_t>(std::clamp(std::round((x[3*i+d] - lo[d]) * scale[d]), 0., top));
+        for (size_t j = 0; j < 3 * n; j++)
+            out[j] = key ? codes[j] : zigzag(static_cast<int64_t>(codes[j]) - last[j]);
+        last.swap(codes);
+    }
+
+    void encode(const double *const pos_buffer, const double *const vel_buffer, const double time)
+    {   bool key = since_key >= keyframe_interval;
+        if (key || !fits(pos_buffer, box, box + 3))
+        {   choose_box(pos_buffer, box, box + 3);
+            key = true;
+        }
+        if (velocities && (key || !fits(vel_buffer, box + 6, box + 9)))
+        {   choose_box(vel_buffer, box + 6, box + 9);
+            key = true;
+        }
+        quantize(pos_buffer, box, box + 3, pos_bits, key, pos_codes, &pos_pending[n_pending * n * 3]);
+        if (velocities)
+            quantize(vel_buffer, box + 6, box + 9, vel_bits, key, vel_codes, &vel_pending[n_pending * n * 3]);
+        std::copy(box, box + 12, &box_pending[n_pending * 12]);
+        time_pending[n_pending] = time;
+        key_pending[n_pending] = key;
+        since_key = key ? 1 : since_key + 1;
+        if (++n_pending == time_chunk_size)
+            flush();
+    }
+
+    static void append(DataSet &set, const int rank, const hsize_t *const shape, const hsize_t *const slab_shape,
+                       const hsize_t *const slab_offset, const void *const buffer, const PredType &type)
+    {   set.extend(shape);
+        DataSpace space = set.getSpace();
+        space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+        set.write(buffer, type, DataSpace {rank, slab_shape}, space);
+    }
+
+    //  codes of rows from the last keyframe up to t, summed and scaled back with the box of t
+    void decode(const DataSet &set, const size_t which, const hsize_t t, double *const buffer) const
+    {   hsize_t key = t;
+        while (!keys[key])
+            key--;
+        std::vector<uint32_t> rows((t - key + 1) * n * 3);
+        hsize_t slab_shape[3] {t - key + 1, n, 3};
+        hsize_t slab_offset[3] {key, 0, 0};
+        DataSpace space = set.getSpace();
+        space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+        set.read(rows.data(), PredType::NATIVE_UINT32, DataSpace {3, slab_shape}, space);
+
+        unsigned bits[2];
+        file.openAttribute("bits").read(PredType::NATIVE_UINT, bits);
+        double box_t[12];
+        hsize_t box_slab_shape[2] {1, 12};
+        hsize_t box_slab_offset[2] {t, 0};
+        DataSpace box_space = box_set.getSpace();
+        box_space.selectHyperslab(H5S_SELECT_SET, box_slab_shape, box_slab_offset);
+        box_set.read(box_t, PredType::NATIVE_DOUBLE, DataSpace {2, box_slab_shape}, box_space);
+        const double *const lo = box_t + 6 * which;
+        const double *const hi = lo + 3;
+        const double top = static_cast<double>((uint32_t {1} << bits[which]) - 1);
+
+        for (size_t j = 0; j < 3 * n; j++)
+        {   int64_t code = rows[j];
+            for (hsize_t r = 1; r <= t - key; r++)
+                code += unzigzag(rows[r * n * 3 + j]);
+            const size_t d = j % 3;
+            buffer[j] = lo[d] + code * ((hi[d] - lo[d]) / top);
+        }
+    }
+};
+
+}
@@ -26,6 +26,9 @@
 #include <H5Cpp.h>
 #include <string>
 #include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
 
 namespace Storage
 {
@@ -33,28 +36,82 @@ namespace Storage
 using namespace H5;
 
 //  time dependent 3D n-body storage directly via HDF5
+//  snapshots are buffered and appended a whole chunk at a time, so every chunk is compressed and written once
+//  appends end on chunk boundaries of the group, also when the group did not start on one (like the ic group)
+//  buffered snapshots are written by flush, at the latest when the storage is destroyed
+//  new objects use the HDF5 1.10 file format, whose chunk index suits datasets growing along one dimension
 
 template <hsize_t time_group_size = 256, hsize_t time_chunk_size = 16>
 struct N_Body_h5
 {
+    static_assert(time_group_size % time_chunk_size == 0);
+
     H5File file;
     size_t current_group_name;
     Group current_group;
+    hsize_t n;                          // # objects
+    hsize_t current_size;               // # snapshots written to the current group
     DataSet current_pos_set;
     DataSet current_vel_set;
     DataSet current_time_set;
+    std::vector<double> pos_pending;    // snapshots not written yet
+    std::vector<double> vel_pending;
+    std::vector<double> time_pending;
+    hsize_t n_pending = 0;
+    bool pending_vel = false;
+
+    //  metadata in larger blocks, and the newer object formats
+    static FileAccPropList file_access()
+    {   FileAccPropList properties;
+        hsize_t meta_block_size = 1 << 16;
+        properties.setMetaBlockSize(meta_block_size);
+        properties.setLibverBounds(H5F_LIBVER_V110, H5F_LIBVER_LATEST);
+        return properties;
+    }
+
+    //  room for one chunk in the chunk cache, evicting fully written chunks first
+    DSetAccPropList set_access() const
+    {   DSetAccPropList properties;
+        properties.setChunkCache(521, 2 * time_chunk_size * n * 3 * sizeof(double), 1);
+        return properties;
+    }
 
     explicit N_Body_h5(std::string name)
-        : file {std::move(name) + ".h5", H5F_ACC_RDWR},
-          current_group_name {file.openGroup("/").getNumObjs() - 2},
+        : file {std::move(name) + ".h5", H5F_ACC_RDWR, FileCreatPropList::DEFAULT, file_access()},
+          current_group_name {last_group(file)},
           current_group      {file.openGroup(std::to_string(current_group_name))},
-          current_pos_set    {current_group.openDataSet("pos")},
-          current_vel_set    {current_group.openDataSet("vel")},
-          current_time_set   {current_group.openDataSet("time")}
-    {}
+          n                  {n_objects(current_group_name)}
+    {   const DSetAccPropList access = set_access();
+        current_pos_set  = current_group.openDataSet("pos", access);
+        if (current_group.nameExists("vel"))
+            current_vel_set = current_group.openDataSet("vel", access);
+        current_time_set = current_group.openDataSet("time");
+        hsize_t shape[3];
+        current_pos_set.getSpace().getSimpleExtentDims(shape);
+        current_size = shape[0];
+        pos_pending.resize(time_chunk_size * n * 3);
+        time_pending.resize(time_chunk_size);
+    }
 
+    //  groups are numbered from 0, the root also holds datasets like the time ranges and tables of a Series_h5
+    static size_t last_group(const H5File &file)
+    {   Group root = file.openGroup("/");
+        size_t n_groups = 0;
+        for (hsize_t i = 0; i < root.getNumObjs(); i++)
+            if (root.getObjTypeByIdx(i) == H5G_GROUP)
+                n_groups++;
+        return n_groups - 1;
+    }
+
+    //  drivers flush before exit to see write errors, here they can only be reported, not thrown
     ~N_Body_h5()
-    {   file.close();
+    {   try
+        {   flush();
+            file.close();
+        }
+        catch (const Exception &e)
+        {   fprintf(stderr, "N_Body_h5: snapshots may be lost, %s\n", e.getCDetailMsg());
+        }
     }
 
     hsize_t n_objects(size_t group_name = 0) const
@@ -105,80 +162,121 @@ struct N_Body_h5
     }
 
     void write(const double *const pos_buffer, const double time)
-    {
-        DataSpace current_pos_space = current_pos_set.getSpace();
-        DataSpace current_time_space = current_time_set.getSpace();
-        hsize_t current_pos_shape[3];
-        current_pos_space.getSimpleExtentDims(current_pos_shape);
-        if (current_pos_shape[0] == time_group_size)
-        {   current_group = file.createGroup(std::to_string(++current_group_name));
-            current_pos_shape[0] = 0;
-            hsize_t max_pos_shape[3] {H5S_UNLIMITED, current_pos_shape[1], 3};
-            current_pos_space.setExtentSimple(3, current_pos_shape, max_pos_shape);
-            DSetCreatPropList properties;
-            hsize_t chunk_shape[3] {time_chunk_size, current_pos_shape[1], 3};
-            properties.setChunk(3, chunk_shape);
-            constexpr double filler = 0;
-            properties.setFillValue(PredType::NATIVE_DOUBLE, &filler);
-            properties.setSzip(H5_SZIP_NN_OPTION_MASK, 8);
-            current_pos_set = current_group.createDataSet("pos", PredType::NATIVE_DOUBLE, current_pos_space, properties);
-            current_time_space.setExtentSimple(1, current_pos_shape, max_pos_shape);
-            properties.setChunk(1, chunk_shape);
-            current_time_set = current_group.createDataSet("time", PredType::NATIVE_DOUBLE, current_time_space, properties);
-        }
-        current_pos_shape[0]++;
-        current_pos_set.extend(current_pos_shape);
-        current_time_set.extend(current_pos_shape);
-        current_pos_space = current_pos_set.getSpace();
-        current_time_space = current_time_set.getSpace();
-        hsize_t slab_shape[3] {1, current_pos_shape[1], 3};
-        hsize_t slab_offset[3] {current_pos_shape[0] - 1, 0, 0};
-        current_pos_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
-        current_time_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
-        DataSpace pos_mem_space {3, slab_shape};
-        DataSpace time_mem_space {1, slab_shape};
-        current_pos_set.write(pos_buffer, PredType::NATIVE_DOUBLE, pos_mem_space, current_pos_space);
-        current_time_set.write(&time, PredType::NATIVE_DOUBLE, time_mem_space, current_time_space);
+    {   if (n_pending != 0 && pending_vel)
+            flush();
+        pending_vel = false;
+        buffer(pos_buffer, nullptr, time);
     }
 
     void write(const double *const pos_buffer, const double *const vel_buffer, const double time)
+    {   if (n_pending != 0 && !pending_vel)
+            flush();
+        pending_vel = true;
+        if (vel_pending.empty())
+            vel_pending.resize(time_chunk_size * n * 3);
+        buffer(pos_buffer, vel_buffer, time);
+    }
+
+    //  append the buffered snapshots, starting new groups as needed
+    void flush()
+    {   hsize_t done = 0;
+        while (done < n_pending)
+        {   if (current_size == time_group_size)
+                create_group();
+            const hsize_t rows = std::min(n_pending - done, time_group_size - current_size);
+            hsize_t shape[3] {current_size + rows, n, 3};
+            hsize_t slab_shape[3] {rows, n, 3};
+            hsize_t slab_offset[3] {current_size, 0, 0};
+            DataSpace pos_mem_space {3, slab_shape};
+            DataSpace time_mem_space {1, slab_shape};
+            current_pos_set.extend(shape);
+            DataSpace pos_space = current_pos_set.getSpace();
+            pos_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+            current_pos_set.write(&pos_pending[done * n * 3], PredType::NATIVE_DOUBLE, pos_mem_space, pos_space);
+            if (pending_vel)
+            {   current_vel_set.extend(shape);
+                DataSpace vel_space = current_vel_set.getSpace();
+                vel_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+                current_vel_set.write(&vel_pending[done * n * 3], PredType::NATIVE_DOUBLE, pos_mem_space, vel_space);
+            }
+            current_time_set.extend(shape);
+            DataSpace time_space = current_time_set.getSpace();
+            time_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+            current_time_set.write(&time_pending[done], PredType::NATIVE_DOUBLE, time_mem_space, time_space);
+            current_size += rows;
+            done += rows;
+        }
+        n_pending = 0;
+    }
+
+    //  position of the next snapshot, for checkpoints, buffered snapshots are written first
+    //  tables next to the snapshots, like a Series_h5 on file, keep cursors of their own
+    struct Cursor
     {
-        DataSpace current_pos_space = current_pos_set.getSpace();
-        DataSpace current_time_space = current_time_set.getSpace();
-        hsize_t current_pos_shape[3];
-        current_pos_space.getSimpleExtentDims(current_pos_shape);
-        if (current_pos_shape[0] == time_group_size)
-        {   current_group = file.createGroup(std::to_string(++current_group_name));
-            current_pos_shape[0] = 0;
-            hsize_t max_pos_shape[3] {H5S_UNLIMITED, current_pos_shape[1], 3};
-            current_pos_space.setExtentSimple(3, current_pos_shape, max_pos_shape);
-            DSetCreatPropList properties;
-            hsize_t chunk_shape[3] {time_chunk_size, current_pos_shape[1], 3};
-            properties.setChunk(3, chunk_shape);
-            constexpr double filler = 0;
-            properties.setFillValue(PredType::NATIVE_DOUBLE, &filler);
-            properties.setSzip(H5_SZIP_NN_OPTION_MASK, 8);
-            current_pos_set = current_group.createDataSet("pos", PredType::NATIVE_DOUBLE, current_pos_space, properties);
-            current_vel_set = current_group.createDataSet("vel", PredType::NATIVE_DOUBLE, current_pos_space, properties);
-            current_time_space.setExtentSimple(1, current_pos_shape, max_pos_shape);
-            properties.setChunk(1, chunk_shape);
-            current_time_set = current_group.createDataSet("time", PredType::NATIVE_DOUBLE, current_time_space, properties);
+        uint64_t group;
+        uint64_t size;
+    };
+
+    Cursor cursor()
+    {   flush();
+        return {current_group_name, current_size};
+    }
+
+    //  back to a cursor of this file, dropping the snapshots written after it
+    void seek(const Cursor c)
+    {   n_pending = 0;
+        for (size_t g = c.group + 1; g <= current_group_name; g++)
+            file.unlink(std::to_string(g));
+        current_group_name = c.group;
+        current_group = file.openGroup(std::to_string(current_group_name));
+        const DSetAccPropList access = set_access();
+        hsize_t shape[3] {c.size, n, 3};
+        current_pos_set = current_group.openDataSet("pos", access);
+        current_pos_set.extend(shape);
+        if (current_group.nameExists("vel"))
+        {   //  only written to by the writes with velocities
+            hsize_t vel_shape[3];
+            current_vel_set = current_group.openDataSet("vel", access);
+            current_vel_set.getSpace().getSimpleExtentDims(vel_shape);
+            if (vel_shape[0] > c.size)
+                current_vel_set.extend(shape);
         }
-        current_pos_shape[0]++;
-        current_pos_set.extend(current_pos_shape);
-        current_vel_set.extend(current_pos_shape);
-        current_time_set.extend(current_pos_shape);
-        current_pos_space = current_pos_set.getSpace();
-        current_time_space = current_time_set.getSpace();
-        hsize_t slab_shape [3] {1, current_pos_shape[1], 3};
-        hsize_t slab_offset[3] {current_pos_shape[0] - 1, 0, 0};
-        current_pos_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
-        current_time_space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
-        DataSpace pos_mem_space {3, slab_shape};
-        DataSpace time_mem_space {1, slab_shape};
-        current_pos_set.write(pos_buffer, PredType::NATIVE_DOUBLE, pos_mem_space, current_pos_space);
-        current_vel_set.write(vel_buffer, PredType::NATIVE_DOUBLE, pos_mem_space, current_pos_space);
-        current_time_set.write(&time, PredType::NATIVE_DOUBLE, time_mem_space, current_time_space);
+        current_time_set = current_group.openDataSet("time");
+        current_time_set.extend(shape);
+        current_size = c.size;
+    }
+
+private:
+    void buffer(const double *const pos_buffer, const double *const vel_buffer, const double time)
+    {   std::copy(pos_buffer, pos_buffer + n * 3, &pos_pending[n_pending * n * 3]);
+        if (vel_buffer != nullptr)
+            std::copy(vel_buffer, vel_buffer + n * 3, &vel_pending[n_pending * n * 3]);
+        time_pending[n_pending] = time;
+        n_pending++;
+        if ((current_size + n_pending) % time_chunk_size == 0)
+            flush();
+    }
+
+    //  next group, with empty datasets, vel only when velocities are stored
+    void create_group()
+    {   current_group = file.createGroup(std::to_string(++current_group_name));
+        hsize_t shape[3] {0, n, 3};
+        hsize_t max_shape[3] {H5S_UNLIMITED, n, 3};
+        DataSpace pos_space {3, shape, max_shape};
+        DataSpace time_space {1, shape, max_shape};
+        DSetCreatPropList properties;
+        hsize_t chunk_shape[3] {time_chunk_size, n, 3};
+        properties.setChunk(3, chunk_shape);
+        constexpr double filler = 0;
+        properties.setFillValue(PredType::NATIVE_DOUBLE, &filler);
+        properties.setSzip(H5_SZIP_NN_OPTION_MASK, 8);
+        const DSetAccPropList access = set_access();
+        current_pos_set = current_group.createDataSet("pos", PredType::NATIVE_DOUBLE, pos_space, properties, access);
+        if (pending_vel)
+            current_vel_set = current_group.createDataSet("vel", PredType::NATIVE_DOUBLE, pos_space, properties, access);
+        properties.setChunk(1, chunk_shape);
+        current_time_set = current_group.createDataSet("time", PredType::NATIVE_DOUBLE, time_space, properties);
+        current_size = 0;
     }
 };
 
@@ -0,0 +1,240 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <stdexcept>
+
+namespace Storage
+{
+
+//  time dependent 3D n-body storage as one flat binary file, for readers that map it into memory
+//  layout, all little endian as written by x86:
+//      page 0      header, see Header
+//      index       capacity entries {time, offset of the record}, rounded up to whole pages
+//      records     pos [n, 3] and, if stored, vel [n, 3] doubles, every record padded to whole pages
+//  a record and its index entry are written before count is raised in the header, so readers never see a
+//  partial snapshot. records sit at data_offset + t record_bytes, so any time step is one seek away
+//  see analysis/n_body_raw.py for a numpy reader
+
+struct N_Body_Raw
+{
+    static constexpr size_t page = 4096;
+    static constexpr char magic[8] {'N', 'B', 'O', 'D', 'Y', 'R', 'A', 'W'};
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t version;
+        uint64_t n;                 // # objects
+        uint64_t velocities;        // 1 when records have vel after pos
+        uint64_t record_bytes;
+        uint64_t capacity;          // # index entries
+        uint64_t count;             // # snapshots written
+        uint64_t index_offset;
+        uint64_t data_offset;
+    };
+
+    struct Entry
+    {
+        double time;
+        uint64_t offset;
+    };
+
+    int fd = -1;
+    Header header;
+    const char *map = nullptr;      // whole file, when reading
+    size_t map_bytes = 0;
+
+    static uint64_t pages(const uint64_t bytes) noexcept
+    {   return (bytes + page - 1) / page * page;
+    }
+
+    static void check(const bool ok, const char *what)
+    {   if (!ok)
+            throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    //  new file for n objects, with room in the index for capacity snapshots
+    //  the constructors delegate to the default one, so the destructor closes fd when a check throws
+    N_Body_Raw(const std::string &name, const uint64_t n, const bool velocities, const uint64_t capacity = 1 << 16)
+        : N_Body_Raw {}
+    {   fd = open((name + ".nbr").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        check(fd != -1, "N_Body_Raw open");
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = 1;
+        header.n = n;
+        header.velocities = velocities;
+        header.record_bytes = pages((velocities ? 6 : 3) * n * sizeof(double));
+        header.capacity = capacity;
+        header.count = 0;
+        header.index_offset = page;
+        header.data_offset = page + pages(capacity * sizeof(Entry));
+        write_header();
+    }
+
+    //  existing file, mapped for reading
+    explicit N_Body_Raw(const std::string &name)
+        : N_Body_Raw {}
+    {   fd = open((name + ".nbr").c_str(), O_RDONLY);
+        check(fd != -1, "N_Body_Raw open");
+        check(pread(fd, &header, sizeof(Header), 0) == sizeof(Header), "N_Body_Raw read header");
+        if (memcmp(header.magic, magic, sizeof(magic)) != 0)
+            throw std::runtime_error("N_Body_Raw: " + name + ".nbr is not a raw n-body file");
+        struct stat st;
+        check(fstat(fd, &st) == 0, "N_Body_Raw stat");
+        map_bytes = st.st_size;
+        void *m = mmap(nullptr, map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        check(m != MAP_FAILED, "N_Body_Raw mmap");
+        map = static_cast<const char *>(m);
+    }
+
+    //  position of the next snapshot, for checkpoints
+    struct Cursor
+    {
+        uint64_t count;
+    };
+
+    Cursor cursor() const noexcept
+    {   return {header.count};
+    }
+
+    //  existing file, to continue writing at a cursor, dropping the snapshots after it
+    N_Body_Raw(const std::string &name, const Cursor at)
+        : N_Body_Raw {}
+    {   fd = open((name + ".nbr").c_str(), O_RDWR);
+        check(fd != -1, "N_Body_Raw open");
+        check(pread(fd, &header, sizeof(Header), 0) == sizeof(Header), "N_Body_Raw read header");
+        if (memcmp(header.magic, magic, sizeof(magic)) != 0)
+            throw std::runtime_error("N_Body_Raw: " + name + ".nbr is not a raw n-body file");
+        if (at.count > header.count)
+            throw std::runtime_error("N_Body_Raw: " + name + ".nbr ends before the cursor");
+        header.count = at.count;
+        write_header();
+        check(ftruncate(fd, header.data_offset + header.count * header.record_bytes) == 0, "N_Body_Raw truncate");
+    }
+
+    ~N_Body_Raw()
+    {   if (map != nullptr)
+            munmap(const_cast<char *>(map), map_bytes);
+        if (fd != -1)
+            close(fd);
+    }
+
+    N_Body_Raw(const N_Body_Raw &) = delete;
+    N_Body_Raw &operator=(const N_Body_Raw &) = delete;
+
+    uint64_t n_objects() const noexcept
+    {   return header.n;
+    }
+
+    uint64_t n_snapshots() const noexcept
+    {   return header.count;
+    }
+
+    //  only for files without velocities
+    void write(const double *const pos_buffer, const double time)
+    {   if (header.velocities)
+            throw std::invalid_argument("N_Body_Raw: file stores velocities, write them too");
+        append(pos_buffer, nullptr, time);
+    }
+
+    //  only for files with velocities
+    void write(const double *const pos_buffer, const double *const vel_buffer, const double time)
+    {   if (!header.velocities)
+            throw std::invalid_argument("N_Body_Raw: file stores no velocities");
+        append(pos_buffer, vel_buffer, time);
+    }
+
+    //  zero copy access to snapshot t of a mapped file
+    const double *pos(const uint64_t t) const noexcept
+    {   return reinterpret_cast<const double *>(map + entry(t).offset);
+    }
+
+    const double *vel(const uint64_t t) const noexcept
+    {   return pos(t) + 3 * header.n;
+    }
+
+    double time(const uint64_t t) const noexcept
+    {   return entry(t).time;
+    }
+
+    void read(double *const pos_buffer, const uint64_t t) const noexcept
+    {   memcpy(pos_buffer, pos(t), 3 * header.n * sizeof(double));
+    }
+
+    void read(double *const pos_buffer, double *const vel_buffer, const uint64_t t) const noexcept
+    {   memcpy(pos_buffer, pos(t), 3 * header.n * sizeof(double));
+        memcpy(vel_buffer, vel(t), 3 * header.n * sizeof(double));
+    }
+
+private:
+    N_Body_Raw() = default;
+
+    const Entry &entry(const uint64_t t) const noexcept
+    {   return reinterpret_cast<const Entry *>(map + header.index_offset)[t];
+    }
+
+    void write_header()
+    {   check(pwrite(fd, &header, sizeof(Header), 0) == sizeof(Header), "N_Body_Raw write header");
+    }
+
+    void write_all(const void *const buffer, const size_t bytes, const uint64_t offset, const char *what)
+    {   const char *p = static_cast<const char *>(buffer);
+        size_t done = 0;
+        while (done < bytes)
+        {   const ssize_t w = pwrite(fd, p + done, bytes - done, offset + done);
+            check(w > 0, what);
+            done += w;
+        }
+    }
+
+    void append(const double *const pos_buffer, const double *const vel_buffer, const double time)
+    {   if (header.count == header.capacity)
+            throw std::length_error("N_Body_Raw: index full, make the file with a larger capacity");
+        const uint64_t bytes = 3 * header.n * sizeof(double);
+        const Entry e {time, header.data_offset + header.count * header.record_bytes};
+        write_all(pos_buffer, bytes, e.offset, "N_Body_Raw write pos");
+        if (header.velocities)
+            write_all(vel_buffer, bytes, e.offset + bytes, "N_Body_Raw write vel");
+        //  the padding of the last record, so that the file always ends on a whole record
+        if ((header.velocities ? 2 : 1) * bytes < header.record_bytes)
+        {   const char zero = 0;
+            write_all(&zero, 1, e.offset + header.record_bytes - 1, "N_Body_Raw write padding");
+        }
+        write_all(&e, sizeof(Entry), header.index_offset + header.count * sizeof(Entry), "N_Body_Raw write index");
+        header.count++;
+        write_header();
+    }
+};
+
+}
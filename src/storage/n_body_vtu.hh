@@ -53,6 +53,7 @@ class N_Body_vtu
     vtkDoubleArray *vel = NULL;
     vtkIdType n_objs;
     size_t time_count = 0;
+    bool started = false;   // whether the writer has a file open
     std::string name_no_suffix;
 
     void pre_read()
@@ -94,7 +95,8 @@ public:
 
     ~N_Body_vtu()
     {   if (writer != NULL)
-        {   writer->Stop();
+        {   if (started)
+                writer->Stop();
             pos->Delete();
             if (vel != NULL)
                 vel->Delete();
@@ -127,6 +129,29 @@ public:
         write(0);
     }
 
+    //  position of the next snapshot, for checkpoints
+    size_t cursor() const
+    {   return time_count;
+    }
+
+    //  instead of read when resuming at a cursor: writes from the buffers without an initial snapshot,
+    //  a partly written file is continued in a new one with the cursor appended, so no file is overwritten
+    void resume(double *const pos_buffer, double *const vel_buffer, const size_t count)
+    {   if (grid == NULL)
+            pre_read();
+        reader->Delete();
+        reader = NULL;
+        pre_write();
+        set_buffers(pos_buffer, vel_buffer);
+        time_count = count;
+        if (time_count % time_steps_per_file != 0)
+        {   writer->SetFileName((name_no_suffix + std::to_string(time_count / time_steps_per_file)
+                                 + "_" + std::to_string(time_count)).c_str());
+            writer->Start();
+            started = true;
+        }
+    }
+
     void set_buffer(double *const pos_buffer)
     {   pos->SetVoidArray(pos_buffer, 3 * n_objs, 1);
     }
@@ -143,10 +168,11 @@ public:
 
     void write(const double time)
     {   if (time_count % time_steps_per_file == 0)
-        {   if (time_count != 0)
+        {   if (started)
                 writer->Stop();
             writer->SetFileName((name_no_suffix + std::to_string(time_count / time_steps_per_file)).c_str());
             writer->Start();
+            started = true;
         }
         pos->Modified();
         if (vel != NULL)
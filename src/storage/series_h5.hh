@@ -0,0 +1,128 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Olaf Willocx
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <H5Cpp.h>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+namespace Storage
+{
+
+using namespace H5;
+
+//  tables at the root of an HDF5 file, for small time series like diagnostics, rows are written right away
+//  a table is [rows, n_columns] doubles, with the column names as attribute
+
+DataSet create_table(H5File &file, const std::string &table, const char *const *const columns,
+                     const hsize_t n_columns)
+{   hsize_t shape[2] {0, n_columns};
+    hsize_t max_shape[2] {H5S_UNLIMITED, n_columns};
+    hsize_t chunk_shape[2] {256, n_columns};
+    DSetCreatPropList properties;
+    properties.setChunk(2, chunk_shape);
+    DataSet set = file.createDataSet(table, PredType::NATIVE_DOUBLE, DataSpace {2, shape, max_shape}, properties);
+    StrType name_type {PredType::C_S1, H5T_VARIABLE};
+    hsize_t name_shape[1] {n_columns};
+    set.createAttribute("columns", name_type, DataSpace {1, name_shape}).write(name_type, columns);
+    return set;
+}
+
+void append_row(DataSet &set, const double *const row, const hsize_t n_columns)
+{   hsize_t shape[2];
+    set.getSpace().getSimpleExtentDims(shape);
+    hsize_t slab_shape[2] {1, n_columns};
+    hsize_t slab_offset[2] {shape[0], 0};
+    shape[0]++;
+    set.extend(shape);
+    DataSpace space = set.getSpace();
+    space.selectHyperslab(H5S_SELECT_SET, slab_shape, slab_offset);
+    set.write(row, PredType::NATIVE_DOUBLE, DataSpace {2, slab_shape}, space);
+}
+
+//  one table, in a file of its own for the drivers whose snapshots are not stored by N_Body_h5,
+//  or next to the snapshots in the file of an N_Body_h5
+struct Series_h5
+{
+    H5File file;
+    hsize_t n_columns;
+    DataSet set;
+    hsize_t rows;
+
+    //  new file
+    Series_h5(std::string name, const std::string &table, const char *const *const columns, const hsize_t n_columns)
+        : Series_h5 {H5File {std::move(name) + ".h5", H5F_ACC_TRUNC}, table, columns, n_columns}
+    {}
+
+    //  table in an open file, appended to when it exists already
+    Series_h5(const H5File &file, const std::string &table, const char *const *const columns, const hsize_t n_columns)
+        : file {file}, n_columns {n_columns},
+          set {file.nameExists(table) ? file.openDataSet(table) : create_table(this->file, table, columns, n_columns)}
+    {   hsize_t shape[2];
+        set.getSpace().getSimpleExtentDims(shape);
+        if (shape[1] != n_columns)
+            throw std::invalid_argument("Series_h5: table has other columns");
+        rows = shape[0];
+    }
+
+    //  # rows written, for checkpoints, the file is flushed first
+    struct Cursor
+    {
+        uint64_t rows;
+    };
+
+    Cursor cursor()
+    {   file.flush(H5F_SCOPE_LOCAL);
+        return {rows};
+    }
+
+    //  existing file, to continue writing at a cursor, dropping the rows after it
+    Series_h5(std::string name, const std::string &table, const hsize_t n_columns, const Cursor at)
+        : Series_h5 {H5File {std::move(name) + ".h5", H5F_ACC_RDWR}, table, n_columns, at}
+    {}
+
+    //  same for a table in an open file
+    Series_h5(const H5File &file, const std::string &table, const hsize_t n_columns, const Cursor at)
+        : file {file}, n_columns {n_columns}, set {file.openDataSet(table)}, rows {at.rows}
+    {   hsize_t shape[2];
+        set.getSpace().getSimpleExtentDims(shape);
+        if (shape[1] != n_columns)
+            throw std::invalid_argument("Series_h5: table has other columns");
+        if (rows > shape[0])
+            throw std::invalid_argument("Series_h5: table ends before the cursor");
+        shape[0] = rows;
+        set.extend(shape);
+    }
+
+    Series_h5(const Series_h5 &) = delete;
+    Series_h5 &operator=(const Series_h5 &) = delete;
+
+    void write(const double *const row)
+    {   append_row(set, row, n_columns);
+        rows++;
+    }
+};
+
+}